@@ -0,0 +1,297 @@
+//
+//  LookupBenchmark.cpp
+//  rime-dictionary-lookup-filter
+//
+//  Micro-benchmark of the lookup/expansion engine outside an IME session.
+//
+//  usage: dictionary-lookup-benchmark [--memo N] [--iterations N] [file.dict.yaml]
+//
+//  Without a dictionary file a synthetic one is generated, with canonical
+//  redirects, '|'-separated components and pronOrder in the 8+ column format.
+//
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <new>
+#include <string>
+#include <vector>
+#include "LookupExpander.hpp"
+#include "LookupIndex.hpp"
+
+namespace {
+
+std::atomic<size_t> allocations(0);
+
+}  // namespace
+
+// Every allocation goes through these, so that the counts include arrays.
+// GCC warns about the free() once it inlines a replaced operator delete into
+// code whose allocation it took for the library operator new; both sides
+// are replaced here, so the pairing is right.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void* operator new(size_t size) {
+    ++allocations;
+    if (void* p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept {
+    std::free(p);
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+namespace {
+
+using rime::LookupExpander;
+using rime::LookupIndex;
+using std::string;
+using std::vector;
+
+struct Lookup {
+    string honzi;
+    string jyutping;
+    bool isSentence;
+};
+
+struct Scenario {
+    const char* name;
+    // every call is one filter-level lookup: a word, or all words of a sentence
+    vector<vector<Lookup>> calls;
+};
+
+class Random {
+  public:
+    explicit Random(uint32_t seed) : state_(seed) {}
+    uint32_t operator()(uint32_t bound) {
+        state_ = state_ * 1664525u + 1013904223u;
+        return (state_ >> 8) % bound;
+    }
+
+  private:
+    uint32_t state_;
+};
+
+string Definition(Random& random) {
+    static const char* words[] = {"harbour", "fragrant", "port", "city", "sea",
+                                  "island", "(n.)", "(v.)", "mountain", "river"};
+    string text;
+    for (int i = 0; i < 6; ++i) {
+        if (i)
+            text += ' ';
+        text += words[random(10)];
+    }
+    return text;
+}
+
+string Row(const string& pron, const string& canonicalHonzi,
+           const string& canonicalJyutping, const string& components,
+           const string& componentProns, int pronOrder, Random& random) {
+    string row = pron + ",,," + canonicalHonzi + "," + canonicalJyutping + "," +
+                 components + "," + componentProns + "," +
+                 std::to_string(pronOrder);
+    // definition and language columns
+    for (int i = 0; i < 12; ++i)
+        row += "," + (random(3) ? Definition(random) : string());
+    return row;
+}
+
+const int kCharacters = 3000;
+const int kWords = 6000;
+const int kFanOutWords = 200;
+const int kFanOutComponents = 12;
+
+string Character(int i) { return "c" + std::to_string(i); }
+string CharacterPron(int i, int reading) {
+    return "p" + std::to_string(i % 700) + std::to_string(1 + reading);
+}
+
+void BuildSyntheticIndex(LookupIndex& index, vector<Lookup>& words,
+                         vector<Lookup>& fanOutWords) {
+    Random random(42);
+    for (int i = 0; i < kCharacters; ++i) {
+        const int readings = 1 + random(3);
+        for (int r = 0; r < readings; ++r) {
+            // every tenth reading redirects to a canonical character
+            const bool redirect = random(10) == 0;
+            const int target = random(kCharacters);
+            index.Add(Character(i),
+                      Row(CharacterPron(i, r),
+                          redirect ? Character(target) : "",
+                          redirect ? CharacterPron(target, 0) : "",
+                          "", "", readings - r, random));
+        }
+    }
+    for (int i = 0; i < kWords; ++i) {
+        const string honzi = "w" + std::to_string(i);
+        string components, componentProns, pron;
+        for (int k = 0, length = 2 + random(3); k < length; ++k) {
+            const int c = random(kCharacters);
+            components += (k ? "|" : "") + Character(c);
+            componentProns += (k ? "|" : "") + CharacterPron(c, 0);
+            pron += CharacterPron(c, 0);
+        }
+        index.Add(honzi, Row(pron, "", "", components, componentProns, 0, random));
+        words.push_back({honzi, pron, false});
+    }
+    // phrases whose components are words with components of their own
+    for (int i = 0; i < kFanOutWords; ++i) {
+        const string honzi = "f" + std::to_string(i);
+        string components, componentProns, pron;
+        for (int k = 0; k < kFanOutComponents; ++k) {
+            const Lookup& component = words[random(words.size())];
+            components += (k ? "|" : "") + component.honzi;
+            componentProns += (k ? "|" : "") + component.jyutping;
+            pron += component.jyutping;
+        }
+        index.Add(honzi, Row(pron, "", "", components, componentProns, 0, random));
+        fanOutWords.push_back({honzi, pron, false});
+    }
+    index.Finish();
+}
+
+bool LoadDictionaryFile(const char* path, LookupIndex& index, vector<Lookup>& words) {
+    std::ifstream in(path);
+    if (!in)
+        return false;
+    string line;
+    bool body = false;
+    while (std::getline(in, line)) {
+        if (!body) {
+            body = line == "...";
+            continue;
+        }
+        const size_t tab = line.find('\t');
+        if (line.empty() || line[0] == '#' || tab == string::npos)
+            continue;
+        const string text = line.substr(0, tab);
+        const string honzi = line.substr(tab + 1, line.find('\t', tab + 1) - tab - 1);
+        index.Add(honzi, text);
+        words.push_back({honzi, text.substr(0, text.find(',')), false});
+    }
+    index.Finish();
+    return true;
+}
+
+double Percentile(const vector<double>& sorted, double p) {
+    if (sorted.empty())
+        return 0;
+    return sorted[std::min(sorted.size() - 1, size_t(p * sorted.size()))];
+}
+
+void Run(const Scenario& scenario, LookupExpander& expander, int iterations) {
+    vector<double> latencies;
+    size_t totalAllocations = 0, totalRows = 0, totalBytes = 0;
+    for (int iteration = 0; iteration < iterations; ++iteration) {
+        for (const vector<Lookup>& call : scenario.calls) {
+            const size_t allocationsBefore = allocations;
+            const auto start = std::chrono::steady_clock::now();
+            string comment;
+            for (const Lookup& lookup : call)
+                comment += expander.ParseEntry(lookup.honzi, lookup.jyutping,
+                                               lookup.isSentence);
+            const auto end = std::chrono::steady_clock::now();
+            totalAllocations += allocations - allocationsBefore;
+            latencies.push_back(
+                std::chrono::duration<double, std::micro>(end - start).count());
+            totalRows += std::count(comment.begin(), comment.end(), '\r');
+            totalBytes += comment.size();
+        }
+    }
+    std::sort(latencies.begin(), latencies.end());
+    const double calls = std::max<size_t>(latencies.size(), 1);
+    std::printf("%-12s %8zu %9.2f %9.2f %9.2f %9.2f %11.1f %9.1f %10.1f\n",
+                scenario.name, latencies.size(), Percentile(latencies, 0.5),
+                Percentile(latencies, 0.9), Percentile(latencies, 0.99),
+                latencies.empty() ? 0 : latencies.back(),
+                totalAllocations / calls, totalRows / calls, totalBytes / calls);
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    size_t memo = 0;
+    int iterations = 3;
+    const char* dictionaryFile = nullptr;
+    for (int i = 1; i < argc; ++i) {
+        if (!std::strcmp(argv[i], "--memo") && i + 1 < argc)
+            memo = std::atoi(argv[++i]);
+        else if (!std::strcmp(argv[i], "--iterations") && i + 1 < argc)
+            iterations = std::max(1, std::atoi(argv[++i]));
+        else
+            dictionaryFile = argv[i];
+    }
+
+    LookupIndex index;
+    vector<Lookup> words, fanOutWords;
+    const auto loadStart = std::chrono::steady_clock::now();
+    if (dictionaryFile) {
+        if (!LoadDictionaryFile(dictionaryFile, index, words)) {
+            std::fprintf(stderr, "cannot read %s\n", dictionaryFile);
+            return 1;
+        }
+    } else {
+        BuildSyntheticIndex(index, words, fanOutWords);
+    }
+    const double loadMs = std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - loadStart).count();
+    std::printf("indexed %zu rows of %zu entries in %.1f ms\n",
+                index.row_count(), index.entry_count(), loadMs);
+
+    Scenario word = {"word", {}};
+    for (const Lookup& lookup : words)
+        word.calls.push_back({lookup});
+    // sentences of four consecutive words, looked up word by word
+    Scenario sentence = {"sentence", {}};
+    for (size_t i = 0; i + 4 <= words.size(); i += 4) {
+        vector<Lookup> call(words.begin() + i, words.begin() + i + 4);
+        for (Lookup& lookup : call)
+            lookup.isSentence = true;
+        sentence.calls.push_back(call);
+    }
+    Scenario fanOut = {"fan-out", {}};
+    for (const Lookup& lookup : fanOutWords)
+        fanOut.calls.push_back({lookup});
+
+    LookupExpander expander(memo);
+    expander.Reset(&index);
+    std::printf("%-12s %8s %9s %9s %9s %9s %11s %9s %10s\n", "scenario",
+                "calls", "p50(us)", "p90(us)", "p99(us)", "max(us)",
+                "allocs/call", "rows/call", "bytes/call");
+    for (const Scenario* scenario : {&word, &sentence, &fanOut}) {
+        if (!scenario->calls.empty())
+            Run(*scenario, expander, iterations);
+    }
+    if (memo > 0)
+        std::printf("expansion memo: %zu hits, %zu misses\n", expander.hits(),
+                    expander.misses());
+    return 0;
+}
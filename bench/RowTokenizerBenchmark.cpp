@@ -0,0 +1,184 @@
+//
+//  RowTokenizerBenchmark.cpp
+//  rime-dictionary-lookup-filter
+//
+//  Micro-benchmark of splitting dictionary rows into columns and component
+//  fields: the scalar string_view::find loops the index used to run against
+//  each FindDelimiters() implementation the CPU supports.
+//
+//  usage: dictionary-lookup-tokenizer-benchmark [--iterations N] [file.dict.yaml]
+//
+//  Without a dictionary file synthetic rows in the 8+ column format are used.
+//
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "RowTokenizer.hpp"
+
+namespace {
+
+using std::string;
+using std::vector;
+
+class Random {
+  public:
+    explicit Random(uint32_t seed) : state_(seed) {}
+    uint32_t operator()(uint32_t bound) {
+        state_ = state_ * 1664525u + 1013904223u;
+        return (state_ >> 8) % bound;
+    }
+
+  private:
+    uint32_t state_;
+};
+
+vector<string> SyntheticRows() {
+    static const char* words[] = {"harbour", "fragrant", "port", "city", "sea",
+                                  "island", "(n.)", "(v.)", "mountain", "river"};
+    Random random(42);
+    vector<string> rows;
+    for (int i = 0; i < 20000; ++i) {
+        string components, componentProns;
+        for (int k = 0, length = random(4); k < length; ++k) {
+            components += (k ? "|" : "") + std::to_string(random(3000));
+            componentProns += (k ? "|" : "") + ("p" + std::to_string(random(700)));
+        }
+        string row = "p" + std::to_string(i % 700) + ",,,,," + components + "," +
+                     componentProns + "," + std::to_string(random(4));
+        // definition and language columns
+        for (int c = 0; c < 12; ++c) {
+            row += ',';
+            for (int w = 0, count = random(3) ? 6 : 0; w < count; ++w)
+                row += string(w ? " " : "") + words[random(10)];
+        }
+        rows.push_back(row);
+    }
+    return rows;
+}
+
+bool DictionaryRows(const char* path, vector<string>& rows) {
+    std::ifstream in(path);
+    if (!in)
+        return false;
+    string line;
+    bool body = false;
+    while (std::getline(in, line)) {
+        if (!body) {
+            body = line == "...";
+            continue;
+        }
+        const size_t tab = line.find('\t');
+        if (!line.empty() && line[0] != '#' && tab != string::npos)
+            rows.push_back(line.substr(0, tab));
+    }
+    return true;
+}
+
+// What parsing a row costs: the ends of the 8 leading columns, the start of
+// the rest, and the '|' fields of columns 5 and 6, as a checksum.
+size_t SplitWithFind(std::string_view line) {
+    size_t sum = 0, start = 0, columns = 0;
+    std::string_view componentColumns[2];
+    while (columns < 8) {
+        const size_t comma = line.find(',', start);
+        const std::string_view column = line.substr(start, comma - start);
+        if (columns == 5 || columns == 6)
+            componentColumns[columns - 5] = column;
+        ++columns;
+        if (comma == std::string_view::npos)
+            break;
+        sum += comma;
+        start = comma + 1;
+    }
+    for (std::string_view rest : componentColumns) {
+        for (size_t pipe = rest.find('|'); pipe != std::string_view::npos;
+             pipe = rest.find('|', pipe + 1))
+            sum += rest.data() - line.data() + pipe;
+    }
+    return sum + columns;
+}
+
+size_t SplitWithScanner(std::string_view line,
+                        vector<uint32_t>& delimiters,
+                        rime::DelimiterScanner scanner) {
+    delimiters.clear();
+    rime::FindDelimiters(line, 8, delimiters, scanner);
+    size_t sum = 0, commas = 0;
+    for (const uint32_t pos : delimiters) {
+        if (line[pos] == ',') {
+            if (commas == 8)
+                break;
+            ++commas;
+            sum += pos;
+        } else if (commas == 5 || commas == 6) {
+            sum += pos;
+        }
+    }
+    return sum + std::min<size_t>(commas + 1, 8);
+}
+
+template <class Split>
+void Run(const char* name, const vector<string>& rows, size_t bytes, int iterations,
+         Split split) {
+    size_t checksum = 0;
+    double best = 0;
+    for (int iteration = 0; iteration < iterations; ++iteration) {
+        const auto start = std::chrono::steady_clock::now();
+        for (const string& row : rows)
+            checksum += split(row);
+        const double seconds = std::chrono::duration<double>(
+                std::chrono::steady_clock::now() - start).count();
+        if (iteration == 0 || seconds < best)
+            best = seconds;
+    }
+    std::printf("%-8s %10.1f %10.1f %20zu\n", name, bytes / best / 1e6,
+                best * 1e9 / std::max<size_t>(rows.size(), 1), checksum / iterations);
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    int iterations = 20;
+    const char* dictionaryFile = nullptr;
+    for (int i = 1; i < argc; ++i) {
+        if (!std::strcmp(argv[i], "--iterations") && i + 1 < argc)
+            iterations = std::max(1, std::atoi(argv[++i]));
+        else
+            dictionaryFile = argv[i];
+    }
+
+    vector<string> rows;
+    if (dictionaryFile) {
+        if (!DictionaryRows(dictionaryFile, rows)) {
+            std::fprintf(stderr, "cannot read %s\n", dictionaryFile);
+            return 1;
+        }
+    } else {
+        rows = SyntheticRows();
+    }
+    size_t bytes = 0;
+    for (const string& row : rows)
+        bytes += row.size();
+    std::printf("%zu rows, %.1f bytes/row, best of %d passes\n", rows.size(),
+                double(bytes) / std::max<size_t>(rows.size(), 1), iterations);
+
+    // equal checksums show that every path splits rows the same way
+    std::printf("%-8s %10s %10s %20s\n", "path", "MB/s", "ns/row", "checksum");
+    Run("find", rows, bytes, iterations, SplitWithFind);
+    vector<uint32_t> delimiters;
+    for (int scanner = 0; scanner < rime::kDelimiterScannerCount; ++scanner) {
+        const auto type = rime::DelimiterScanner(scanner);
+        if (!rime::DelimiterScannerSupported(type))
+            continue;
+        Run(rime::DelimiterScannerName(type), rows, bytes, iterations,
+            [&](const string& row) { return SplitWithScanner(row, delimiters, type); });
+    }
+    return 0;
+}
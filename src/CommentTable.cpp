@@ -0,0 +1,151 @@
+//
+//  CommentTable.cpp
+//  rime-dictionary-lookup-filter-objs
+//
+
+#include "CommentTable.hpp"
+
+#include <cstring>
+#include <fstream>
+
+namespace rime {
+
+namespace {
+
+const char kMagic[8] = {'D', 'L', 'C', 'O', 'M', 'M', '0', '3'};
+
+}  // namespace
+
+// Native byte order; a table from a machine of the other order fails the
+// byte order check.
+struct CommentTable::Header {
+    char magic[8];
+    uint32_t byteOrder;
+    uint32_t compact;
+    uint64_t fingerprint;
+    uint64_t budget[4];
+    uint64_t projection;
+    uint64_t entryCount;
+    // open addressing on the key hash, a power of two
+    uint64_t slotCount;
+    uint64_t slotsOffset;
+    uint64_t stringsOffset;
+    uint64_t stringsSize;
+};
+
+// Each key is followed by its comment in the strings block; empty slots
+// have keyLength 0.
+struct CommentTable::Slot {
+    uint64_t hash;
+    uint64_t keyOffset;
+    uint32_t keyLength;
+    uint32_t commentLength;
+};
+
+bool CommentTable::Write(const string& path,
+                         const CommentTableSettings& settings,
+                         const vector<pair<string, string>>& comments) {
+    Header header = {};
+    std::memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.byteOrder = 0x01020304;
+    header.compact = settings.compact;
+    header.fingerprint = settings.fingerprint;
+    header.budget[0] = settings.budget.maxDepth;
+    header.budget[1] = settings.budget.maxLookups;
+    header.budget[2] = settings.budget.maxRows;
+    header.budget[3] = settings.budget.maxBytes;
+    header.projection = settings.projection;
+    header.entryCount = comments.size();
+    header.slotCount = 1;
+    while (header.slotCount < comments.size() * 2)
+        header.slotCount *= 2;
+    header.slotsOffset = sizeof(Header);
+    header.stringsOffset = header.slotsOffset + header.slotCount * sizeof(Slot);
+
+    vector<Slot> slots(header.slotCount, Slot());
+    string strings;
+    for (const auto& comment : comments) {
+        if (comment.first.empty())
+            continue;
+        const uint64_t hash = HashText(comment.first);
+        size_t i = hash & (header.slotCount - 1);
+        while (slots[i].keyLength != 0)
+            i = (i + 1) & (header.slotCount - 1);
+        slots[i] = {hash, strings.size(), uint32_t(comment.first.size()),
+                    uint32_t(comment.second.size())};
+        strings += comment.first;
+        strings += comment.second;
+    }
+    header.stringsSize = strings.size();
+
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(slots.data()), slots.size() * sizeof(Slot));
+    out.write(strings.data(), strings.size());
+    return bool(out);
+}
+
+bool CommentTable::Open(const string& path) {
+    using namespace boost::interprocess;
+    header_ = nullptr;
+    try {
+        file_mapping(path.c_str(), read_only).swap(file_);
+        mapped_region(file_, read_only).swap(region_);
+    } catch (const interprocess_exception&) {
+        return false;
+    }
+    const char* base = static_cast<const char*>(region_.get_address());
+    const uint64_t size = region_.get_size();
+    if (size < sizeof(Header))
+        return false;
+    const Header* header = reinterpret_cast<const Header*>(base);
+    if (std::memcmp(header->magic, kMagic, sizeof(kMagic)) != 0 ||
+        header->byteOrder != 0x01020304 || header->slotCount == 0 ||
+        (header->slotCount & (header->slotCount - 1)) != 0 ||
+        header->slotsOffset != sizeof(Header) ||
+        header->slotCount > (size - header->slotsOffset) / sizeof(Slot) ||
+        header->stringsOffset != header->slotsOffset + header->slotCount * sizeof(Slot) ||
+        header->stringsSize > size - header->stringsOffset)
+        return false;
+    header_ = header;
+    slots_ = reinterpret_cast<const Slot*>(base + header->slotsOffset);
+    strings_ = base + header->stringsOffset;
+    return true;
+}
+
+bool CommentTable::Matches(const CommentTableSettings& settings) const {
+    return header_ && header_->fingerprint == settings.fingerprint &&
+           header_->compact == uint32_t(settings.compact) &&
+           header_->budget[0] == settings.budget.maxDepth &&
+           header_->budget[1] == settings.budget.maxLookups &&
+           header_->budget[2] == settings.budget.maxRows &&
+           header_->budget[3] == settings.budget.maxBytes &&
+           header_->projection == settings.projection;
+}
+
+bool CommentTable::Find(std::string_view key, std::string_view* comment) const {
+    if (!header_ || key.empty())
+        return false;
+    const uint64_t hash = HashText(key);
+    const uint64_t mask = header_->slotCount - 1;
+    for (uint64_t i = hash & mask, probes = 0; probes <= mask; i = (i + 1) & mask, ++probes) {
+        const Slot& slot = slots_[i];
+        if (slot.keyLength == 0)
+            return false;
+        if (slot.hash != hash || slot.keyLength != key.size() ||
+            slot.keyOffset + slot.keyLength + slot.commentLength > header_->stringsSize)
+            continue;
+        const char* text = strings_ + slot.keyOffset;
+        if (std::memcmp(text, key.data(), key.size()) != 0)
+            continue;
+        *comment = std::string_view(text + slot.keyLength, slot.commentLength);
+        return true;
+    }
+    return false;
+}
+
+size_t CommentTable::size() const {
+    return header_ ? header_->entryCount : 0;
+}
+
+}  // namespace rime
@@ -0,0 +1,54 @@
+//
+//  CommentTable.hpp
+//  rime-dictionary-lookup-filter-objs
+//
+
+#ifndef CommentTable_hpp
+#define CommentTable_hpp
+
+#include <rime/common.h>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <cstdint>
+#include <string_view>
+#include "LookupExpander.hpp"
+
+namespace rime {
+
+// What a table was built from; comments depend on all of it.
+struct CommentTableSettings {
+    uint64_t fingerprint = 0;
+    LookupBudget budget;
+    bool compact = false;
+    // TailProjection::fingerprint() of the kept tail columns
+    uint64_t projection = 0;
+};
+
+// Finished comments of a lookup dictionary, keyed by result key and
+// precompiled by dictionary-lookup-build-comments. The table is mapped
+// read-only, so processes using the same file share its pages.
+class CommentTable {
+  public:
+    // Writes the given (result key, comment) pairs to a table file.
+    static bool Write(const string& path,
+                      const CommentTableSettings& settings,
+                      const vector<pair<string, string>>& comments);
+
+    bool Open(const string& path);
+    bool Matches(const CommentTableSettings& settings) const;
+    bool Find(std::string_view key, std::string_view* comment) const;
+    size_t size() const;
+
+  private:
+    struct Header;
+    struct Slot;
+
+    boost::interprocess::file_mapping file_;
+    boost::interprocess::mapped_region region_;
+    const Header* header_ = nullptr;
+    const Slot* slots_ = nullptr;
+    const char* strings_ = nullptr;
+};
+};  // namespace rime
+
+#endif /* CommentTable_hpp */
@@ -6,10 +6,15 @@
 //
 
 #include "DictionaryLookupFilter.hpp"
+#include "LookupIndexRegistry.hpp"
 
 #include <rime/candidate.h>
+#include <rime/config.h>
+#include <rime/context.h>
 #include <rime/engine.h>
+#include <rime/resource.h>
 #include <rime/schema.h>
+#include <rime/service.h>
 #include <rime/translation.h>
 #include <rime/dict/reverse_lookup_dictionary.h>
 #include <rime/dict/dictionary.h>
@@ -18,365 +23,379 @@
 #include <boost/algorithm/string.hpp>
 #include <boost/range/algorithm_ext/erase.hpp>
 #include <algorithm>
-#include <map>
+#include <chrono>
 #include <unordered_set>
-#include <unordered_map>
 
 namespace rime {
 
 namespace {
 
-struct LookupLine {
-    string lookupHonzi;
-    string rawLine;
-    vector<string> columns;
-    string displayHonzi;
-    string displayJyutping;
-    string tail;
-};
-
-struct EmittedLine {
-    string commentLine;
-    string dedupeKey;
-};
-
-vector<string> LeadingColumns(const string& line, const size_t count) {
-    vector<string> columns;
-    size_t start = 0;
-    while (columns.size() < count) {
-        const size_t commaPos = line.find(',', start);
-        if (commaPos == string::npos) {
-            columns.push_back(line.substr(start));
-            break;
+vector<int> ConfigColumns(Config* config, const string& key) {
+    vector<int> columns;
+    if (an<ConfigList> list = config->GetList(key)) {
+        for (size_t i = 0; i < list->size(); ++i) {
+            int column = 0;
+            if (an<ConfigValue> value = list->GetValueAt(i))
+                if (value->GetInt(&column))
+                    columns.push_back(column);
         }
-        columns.push_back(line.substr(start, commaPos - start));
-        start = commaPos + 1;
     }
     return columns;
 }
 
-int PronOrder(const vector<string>& columns) {
-    return columns.size() > 7 && !columns[7].empty()
-           ? std::stoi(columns[7])
-           : 0;
-}
+}  // namespace
 
-size_t ColumnStart(const string& line, const size_t column) {
-    size_t pos = 0;
-    for (size_t i = 0; i < column; ++i) {
-        pos = line.find(',', pos);
-        if (pos == string::npos)
-            return string::npos;
-        ++pos;
-    }
-    return pos;
-}
+class DictionaryLookupFilterTranslation : public CacheTranslation {
+  public:
+    DictionaryLookupFilterTranslation(an<Translation> translation,
+                                      DictionaryLookupFilter* filter)
+            : CacheTranslation(translation), filter_(filter) {}
+    virtual bool Next();
+    virtual an<Candidate> Peek();
 
-string OutputTailWithoutPronOrder(const string& rawLine,
-                                  const vector<string>& columns) {
-    vector<string> outputColumns;
-    for (size_t i = 3; i <= 6; ++i)
-        outputColumns.push_back(i < columns.size() ? columns[i] : "");
-
-    string tail = boost::join(outputColumns, ",");
-    const size_t start = ColumnStart(rawLine, 8);
-    if (start != string::npos)
-        tail += "," + rawLine.substr(start);
-    return tail;
-}
+  protected:
+    DictionaryLookupFilter* filter_;
+    // CacheTranslation hands back the same candidate until Next(), so it is
+    // annotated only on the first Peek. The menu peeks candidates only as it
+    // builds the pages shown, so candidates on later pages are not looked up
+    // until they are paged into view.
+    bool processed_ = false;
+};
 
-LookupLine MakeLookupLine(const string& honzi,
-                          const string& rawLine,
-                          const vector<string>& columns) {
-    return {
-        honzi,
-        rawLine,
-        columns,
-        columns.size() > 1 && !columns[1].empty() ? columns[1] : honzi,
-        columns.size() > 2 && !columns[2].empty() ? columns[2] : columns[0],
-        OutputTailWithoutPronOrder(rawLine, columns),
-    };
+bool DictionaryLookupFilterTranslation::Next() {
+    if (!CacheTranslation::Next())
+        return false;
+    processed_ = false;
+    return true;
 }
 
-string BuildOutputLine(const char matchInputBuffer, const LookupLine& line) {
-    return "\r" + string(1, matchInputBuffer) + "," + line.displayHonzi + "," +
-           line.displayJyutping + "," + line.tail;
+an<Candidate> DictionaryLookupFilterTranslation::Peek() {
+    auto cand = CacheTranslation::Peek();
+    if (cand && !processed_) {
+        processed_ = true;
+        filter_->Process(cand);
+    }
+    return cand;
 }
 
-string DedupeKey(const LookupLine& line) {
-    return line.displayHonzi + "," + line.displayJyutping + "," + line.tail;
-}
+// Pulls the wrapped translation a page at a time, so that the lookups of a
+// whole page can be run on the worker threads before its first candidate
+// is peeked. With prefetch on, the following page is pulled as well and
+// its lookups are started in the background.
+class DictionaryLookupBatchTranslation : public PrefetchTranslation {
+  public:
+    DictionaryLookupBatchTranslation(an<Translation> translation,
+                                     DictionaryLookupFilter* filter)
+            : PrefetchTranslation(translation), filter_(filter) {}
+    virtual bool Next();
+    virtual an<Candidate> Peek();
 
-vector<EmittedLine> DeduplicateRows(
-    const vector<EmittedLine>& rows,
-    const std::unordered_set<string>* skippedKeys = nullptr) {
-    std::unordered_map<string, size_t> lastIndex;
-    for (size_t i = 0; i < rows.size(); ++i) {
-        if (skippedKeys && skippedKeys->find(rows[i].dedupeKey) != skippedKeys->end())
-            continue;
-        lastIndex[rows[i].dedupeKey] = i;
-    }
-    vector<EmittedLine> result;
-    for (size_t i = 0; i < rows.size(); ++i) {
-        const auto last = lastIndex.find(rows[i].dedupeKey);
-        if (last != lastIndex.end() && last->second == i)
-            result.push_back(rows[i]);
-    }
-    return result;
-}
+  protected:
+    virtual bool Replenish();
+    void Pull(const size_t count);
 
-typedef std::multimap<int, LookupLine> OrderedLookupLines;
+    DictionaryLookupFilter* filter_;
+    // leading candidates of cache_ whose page has been looked up
+    size_t batched_ = 0;
+};
 
-bool LookupLines(Dictionary* dictionary,
-                 const string& honzi,
-                 const std::unordered_set<string>& pronunciations,
-                 OrderedLookupLines& matchedLines,
-                 OrderedLookupLines& remainingLines) {
-    DictEntryIterator it;
-    dictionary->LookupWords(&it, honzi, false);
-    if (it.exhausted())
+bool DictionaryLookupBatchTranslation::Next() {
+    if (!PrefetchTranslation::Next())
         return false;
-
-    do {
-        const string rawLine = it.Peek()->text;
-        if (rawLine.empty())
-            continue;
-        const vector<string> columns = LeadingColumns(rawLine, 8);
-        if (columns.empty())
-            continue;
-        const bool match = pronunciations.find(columns[0]) != pronunciations.end();
-        (match ? matchedLines : remainingLines).insert(
-            {PronOrder(columns), MakeLookupLine(honzi, rawLine, columns)});
-    } while (it.Next());
+    if (batched_ > 0)
+        --batched_;
     return true;
 }
 
-vector<EmittedLine> CollectMatchedRows(Dictionary* dictionary,
-                                       string honzi,
-                                       string jyutping,
-                                       const char matchInputBuffer,
-                                       const char componentMatchInputBuffer,
-                                       const bool includeComponentEntries,
-                                       std::unordered_set<string>& activeLookups);
-
-void AppendCanonicalRedirects(Dictionary* dictionary,
-                              vector<EmittedLine>& rows,
-                              const LookupLine& line,
-                              const char componentMatchInputBuffer,
-                              const bool includeComponentEntries,
-                              std::unordered_set<string>& activeLookups) {
-    if (line.columns.size() <= 4 ||
-        (line.columns[3].empty() && line.columns[4].empty()))
-        return;
+an<Candidate> DictionaryLookupBatchTranslation::Peek() {
+    if (!exhausted() && batched_ == 0)
+        Replenish();
+    return PrefetchTranslation::Peek();
+}
 
-    const string canonicalHonzi =
-        line.columns[3].empty() ? line.lookupHonzi : line.columns[3];
-    const string canonicalJyutping =
-        line.columns[4].empty() ? line.columns[0] : line.columns[4];
-    vector<EmittedLine> canonicalRows = CollectMatchedRows(
-        dictionary, canonicalHonzi, canonicalJyutping, '0',
-        componentMatchInputBuffer, includeComponentEntries, activeLookups);
-    rows.insert(rows.end(), canonicalRows.begin(), canonicalRows.end());
+bool DictionaryLookupBatchTranslation::Replenish() {
+    const size_t batchSize = filter_->BatchSize();
+    Pull(filter_->prefetching() ? batchSize * 2 : batchSize);
+    batched_ = std::min(batchSize, cache_.size());
+    auto pageEnd = std::next(cache_.begin(), batched_);
+    filter_->AnnotateBatch(CandidateList(cache_.begin(), pageEnd));
+    if (filter_->prefetching())
+        filter_->Prefetch(CandidateList(pageEnd, cache_.end()));
+    return !cache_.empty();
 }
 
-void AppendCanonicalEntryOrRedirect(Dictionary* dictionary,
-                                    vector<EmittedLine>& rows,
-                                    const LookupLine& line,
-                                    const char matchInputBuffer,
-                                    const char componentMatchInputBuffer,
-                                    const bool includeComponentEntries,
-                                    std::unordered_set<string>& activeLookups) {
-    if (line.columns.size() > 4 && line.columns[3].empty() &&
-        line.columns[4].empty()) {
-        rows.push_back({BuildOutputLine(matchInputBuffer, line), DedupeKey(line)});
-        return;
+// Pulls candidates from the wrapped translation until count of them are cached.
+void DictionaryLookupBatchTranslation::Pull(const size_t count) {
+    while (cache_.size() < count && !translation_->exhausted()) {
+        if (auto cand = translation_->Peek())
+            cache_.push_back(cand);
+        translation_->Next();
     }
-    AppendCanonicalRedirects(dictionary, rows, line, componentMatchInputBuffer,
-                             includeComponentEntries, activeLookups);
 }
 
-void AppendLineWithRelatedEntries(Dictionary* dictionary,
-                                  vector<EmittedLine>& rows,
-                                  const LookupLine& line,
-                                  const char matchInputBuffer,
-                                  const char componentMatchInputBuffer,
-                                  const bool includeComponentEntries,
-                                  std::unordered_set<string>& activeLookups) {
-    rows.push_back({BuildOutputLine(matchInputBuffer, line), DedupeKey(line)});
-
-    // Related rows are collected immediately after their parent row;
-    // later deduplication may keep a duplicate at its last collected position.
-    AppendCanonicalRedirects(dictionary, rows, line, componentMatchInputBuffer,
-                             includeComponentEntries, activeLookups);
-
-    if (!includeComponentEntries || line.columns.size() <= 6 || line.columns[5].empty() ||
-        line.columns[6].empty())
-        return;
+DictionaryLookupFilter::DictionaryLookupFilter(const Ticket& ticket)
+        : Filter(ticket), TagMatching(ticket) {
+    if (ticket.name_space == "filter")
+        name_space_ = "dictionary_lookup_filter";
+    else
+        name_space_ = ticket.name_space;
 
-    vector<string> componentTexts, componentJyutpings;
-    boost::split(componentTexts, line.columns[5], boost::is_any_of("|"));
-    boost::split(componentJyutpings, line.columns[6], boost::is_any_of("|"));
-    for (size_t i = 0; i < componentTexts.size() && i < componentJyutpings.size(); ++i) {
-        if (componentTexts[i].empty() || componentJyutpings[i].empty())
-            continue;
-        vector<EmittedLine> componentRows = CollectMatchedRows(
-            dictionary, componentTexts[i], componentJyutpings[i],
-            componentMatchInputBuffer, componentMatchInputBuffer,
-            includeComponentEntries, activeLookups);
-        rows.insert(rows.end(), componentRows.begin(), componentRows.end());
+    int cacheSize = 500;
+    int expansionCacheSize = 0;
+    bool statistics = false;
+    bool compactOutput = false;
+    int batchThreads = 0;
+    bool prefetch = false;
+    int statisticsInterval = 1000;
+    int maxDepth = kDefaultMaxDepth;
+    int maxLookups = kDefaultMaxLookups;
+    int maxRows = kDefaultMaxRows;
+    int maxCommentBytes = kDefaultMaxBytes;
+    if (Config* config = ticket.engine->schema()->config()) {
+        config->GetString(name_space_ + "/dictionary", &dictname_);
+        config->GetInt(name_space_ + "/cache_size", &cacheSize);
+        config->GetInt(name_space_ + "/expansion_cache_size", &expansionCacheSize);
+        config->GetBool(name_space_ + "/async_load", &asyncLoad_);
+        config->GetBool(name_space_ + "/lookup_only", &lookupOnly_);
+        config->GetInt(name_space_ + "/reload_interval", &reloadInterval_);
+        config->GetBool(name_space_ + "/compact_output", &compactOutput);
+        config->GetInt(name_space_ + "/batch_threads", &batchThreads);
+        config->GetBool(name_space_ + "/prefetch", &prefetch);
+        config->GetBool(name_space_ + "/statistics", &statistics);
+        config->GetInt(name_space_ + "/statistics_interval", &statisticsInterval);
+        config->GetInt(name_space_ + "/max_depth", &maxDepth);
+        config->GetInt(name_space_ + "/max_lookups", &maxLookups);
+        config->GetInt(name_space_ + "/max_rows", &maxRows);
+        config->GetInt(name_space_ + "/max_comment_bytes", &maxCommentBytes);
+        if (!compactOutput) {
+            tailColumns_.first = ConfigColumns(config, name_space_ + "/matched_columns");
+            tailColumns_.second = ConfigColumns(config, name_space_ + "/unmatched_columns");
+        }
     }
-}
-
-vector<EmittedLine> CollectMatchedRows(Dictionary* dictionary,
-                                       string honzi,
-                                       string jyutping,
-                                       const char matchInputBuffer,
-                                       const char componentMatchInputBuffer,
-                                       const bool includeComponentEntries,
-                                       std::unordered_set<string>& activeLookups) {
-    boost::remove_erase_if(jyutping, boost::is_any_of("; "));
-    const string lookupKey = honzi + "\f" + jyutping;
-    if (activeLookups.find(lookupKey) != activeLookups.end())
-        return {};
-    activeLookups.insert(lookupKey);
-
-    std::unordered_set<string> pronunciations;
-    boost::split(pronunciations, jyutping, boost::is_any_of("\f"));
-    OrderedLookupLines matchedLines, remainingLines;
-    if (!LookupLines(dictionary, honzi, pronunciations, matchedLines, remainingLines)) {
-        activeLookups.erase(lookupKey);
-        return {};
+    cache_.set_capacity(std::max(cacheSize, 0));
+    expander_.set_capacity(std::max(expansionCacheSize, 0));
+    LookupBudget budget;
+    budget.maxDepth = std::max(maxDepth, 0);
+    budget.maxLookups = std::max(maxLookups, 0);
+    budget.maxRows = std::max(maxRows, 0);
+    budget.maxBytes = std::max(maxCommentBytes, 0);
+    expander_.set_budget(budget);
+    expander_.set_compact(compactOutput);
+    commentTableSettings_.budget = budget;
+    commentTableSettings_.compact = compactOutput;
+    // Each worker thread owns an expander, as expanders keep per-lookup state.
+    auto newExpander = [&]() {
+        the<LookupExpander> expander(new LookupExpander(std::max(expansionCacheSize, 0)));
+        expander->set_budget(budget);
+        expander->set_compact(compactOutput);
+        return expander;
+    };
+    if (batchThreads > 0) {
+        pool_.reset(new LookupWorkerPool(batchThreads));
+        for (int worker = 0; worker < batchThreads; ++worker)
+            workerExpanders_.push_back(newExpander());
     }
-
-    vector<EmittedLine> rows;
-    for (const pair<int, LookupLine>& line : matchedLines)
-        AppendLineWithRelatedEntries(dictionary, rows, line.second,
-                                     matchInputBuffer, componentMatchInputBuffer,
-                                     includeComponentEntries, activeLookups);
-    activeLookups.erase(lookupKey);
-    return rows;
-}
-
-string ParseEntry(Dictionary* dictionary,
-                  string honzi,
-                  string jyutping,
-                  const bool isSentence,
-                  std::unordered_set<string>& activeLookups) {
-    boost::remove_erase_if(jyutping, boost::is_any_of("; "));
-    const string lookupKey = honzi + "\f" + jyutping;
-    if (activeLookups.find(lookupKey) != activeLookups.end())
-        return "";
-    activeLookups.insert(lookupKey);
-
-    std::unordered_set<string> pronunciations;
-    boost::split(pronunciations, jyutping, boost::is_any_of("\f"));
-    OrderedLookupLines matchedLines, remainingLines;
-    if (!LookupLines(dictionary, honzi, pronunciations, matchedLines, remainingLines)) {
-        activeLookups.erase(lookupKey);
-        return "";
+    if (prefetch)
+        prefetcher_.reset(new LookupPrefetcher(newExpander()));
+    if (statistics) {
+        statistics_.reset(new FilterStatistics(name_space_,
+                                               std::max(statisticsInterval, 0)));
+        expander_.set_counters(&counters_);
     }
 
-    // Emission rules:
-    // - Direct pronunciation matches and their component entries use
-    //   match_input_buffer=1, so they appear in both candidate selection and
-    //   dictionary panels.
-    // - Canonical redirects use match_input_buffer=0 even when collected while
-    //   building the 1 group. Empty canonical columns mean the row is already
-    //   canonical.
-    // - If there are no direct matches for a non-sentence lookup, unmatched
-    //   dictionary rows and their related entries are used as the fallback 1 group.
-    // - If direct matches exist, unmatched canonical rows are kept with 0;
-    //   unmatched noncanonical rows are kept only through their 0 canonical
-    //   redirects.
-    // - Deduplication ignores match_input_buffer and pronOrder, keeps the last
-    //   collected position within each group, and lets the 1 group win over the
-    //   0 group.
-    // - pronOrder is not emitted; it only sorts within one honzi lookup.
-    //   Related canonical/component lookups keep discovery order across honzi.
-    vector<EmittedLine> candidateAndDictionaryRows, dictionaryOnlyRows;
-    const bool hasOnlyUnmatchedWordEntries =
-        !isSentence && matchedLines.empty() && !remainingLines.empty();
-    if (hasOnlyUnmatchedWordEntries) {
-        for (const pair<int, LookupLine>& line : remainingLines)
-            AppendLineWithRelatedEntries(dictionary, candidateAndDictionaryRows, line.second,
-                                         '1', '1', true, activeLookups);
-    } else {
-        for (const pair<int, LookupLine>& line : matchedLines)
-            AppendLineWithRelatedEntries(dictionary, candidateAndDictionaryRows, line.second,
-                                         '1', '1', true, activeLookups);
-        for (const pair<int, LookupLine>& line : remainingLines)
-            AppendCanonicalEntryOrRedirect(dictionary, dictionaryOnlyRows, line.second,
-                                           '0', '0', false, activeLookups);
+    if (Context* context = engine_ ? engine_->context() : nullptr) {
+        commitConnection_ = context->commit_notifier().connect(
+            [this](Context*) {
+                ClearCompositionCache();
+                CancelPrefetch();
+            });
+        updateConnection_ = context->update_notifier().connect(
+            [this](Context* ctx) {
+                if (!ctx->IsComposing())
+                    ClearCompositionCache();
+                // paging does not change the input; a keystroke does
+                if (ctx->input() != prefetchInput_) {
+                    prefetchInput_ = ctx->input();
+                    CancelPrefetch();
+                }
+            });
     }
 
-    candidateAndDictionaryRows = DeduplicateRows(candidateAndDictionaryRows);
-    std::unordered_set<string> insertedKeys;
-    for (const EmittedLine& line : candidateAndDictionaryRows)
-        insertedKeys.insert(line.dedupeKey);
-    dictionaryOnlyRows = DeduplicateRows(dictionaryOnlyRows, &insertedKeys);
-
-    string result;
-    for (const EmittedLine& line : candidateAndDictionaryRows)
-        result += line.commentLine;
-    for (const EmittedLine& line : dictionaryOnlyRows)
-        result += line.commentLine;
-    activeLookups.erase(lookupKey);
-    return result;
+    // Candidates pass through unannotated until the warm-up finishes.
+    if (asyncLoad_ && engine_)
+        loading_ = LookupIndexRegistry::instance().RequireAsync(dictname_, lookupOnly_,
+                                                                 tailColumns_);
 }
 
-}  // namespace
-
-class DictionaryLookupFilterTranslation : public CacheTranslation {
-  public:
-    DictionaryLookupFilterTranslation(an<Translation> translation,
-                                      DictionaryLookupFilter* filter)
-            : CacheTranslation(translation), filter_(filter) {}
-    virtual an<Candidate> Peek();
+DictionaryLookupFilter::~DictionaryLookupFilter() {
+    commitConnection_.disconnect();
+    updateConnection_.disconnect();
+    pool_.reset();
+    prefetcher_.reset();
+    if (cache_.enabled())
+        LOG(INFO) << "dictionary_lookup_filter cache: " << cache_.hits()
+                  << " hits, " << cache_.misses() << " misses.";
+    if (expander_.capacity() > 0)
+        LOG(INFO) << "dictionary_lookup_filter expansion cache: " << expander_.hits()
+                  << " hits, " << expander_.misses() << " misses.";
+    const size_t truncations[] = {
+        expander_.truncations(kDepthLimit), expander_.truncations(kLookupLimit),
+        expander_.truncations(kRowLimit), expander_.truncations(kByteLimit)};
+    if (truncations[0] + truncations[1] + truncations[2] + truncations[3] > 0)
+        LOG(INFO) << "dictionary_lookup_filter truncated lookups: " << truncations[0]
+                  << " by depth, " << truncations[1] << " by lookups, "
+                  << truncations[2] << " by rows, " << truncations[3] << " by bytes.";
+}
 
-  protected:
-    DictionaryLookupFilter* filter_;
-};
+void DictionaryLookupFilter::Initialize() {
+    initialized_ = true;
+    if (!engine_ || loading_.valid())
+        return;
 
-an<Candidate> DictionaryLookupFilterTranslation::Peek() {
-    auto cand = CacheTranslation::Peek();
-    if (cand)
-        filter_->Process(cand);
-    return cand;
+    SetIndex(LookupIndexRegistry::instance().Require(dictname_, lookupOnly_, tailColumns_));
 }
 
-DictionaryLookupFilter::DictionaryLookupFilter(const Ticket& ticket)
-        : Filter(ticket), TagMatching(ticket) {
-    if (ticket.name_space == "filter")
-        name_space_ = "dictionary_lookup_filter";
-    else
-        name_space_ = ticket.name_space;
+bool DictionaryLookupFilter::IndexReady() {
+    if (loading_.valid() &&
+        loading_.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+        // held across Require(), which records it as the shared index
+        const an<const LookupIndex> loaded = loading_.get().index;
+        loading_ = LookupIndexRegistry::PendingIndex();
+        SetIndex(loaded ? LookupIndexRegistry::instance().Require(dictname_, lookupOnly_)
+                        : nullptr);
+    }
+    return index_ != nullptr;
+}
 
-    if (Config* config = ticket.engine->schema()->config())
-        config->GetString(name_space_ + "/dictionary", &dictname_);
+void DictionaryLookupFilter::SetIndex(an<const LookupIndex> index) {
+    // shared with every filter projecting the same columns, and mostly
+    // built next to the index in the background
+    an<const TailProjection> projection =
+            LookupIndexRegistry::instance().Projection(dictname_, index, tailColumns_);
+    index_ = index;
+    expander_.Reset(index_.get(), projection.get());
+    for (auto& expander : workerExpanders_)
+        expander->Reset(index_.get(), projection.get());
+    if (prefetcher_)
+        prefetcher_->Reset(index_.get(), projection.get());
+    // no expander refers to the old projection any more
+    projection_ = projection;
+    commentTableSettings_.projection = projection_ ? projection_->fingerprint() : 0;
+    cache_.Clear();
+    batchResults_.clear();
+    ClearCompositionCache();
+    OpenCommentTable();
 }
 
-void DictionaryLookupFilter::Initialize() {
-    initialized_ = true;
-    if (!engine_)
+void DictionaryLookupFilter::OpenCommentTable() {
+    commentTable_.reset();
+    if (!index_)
+        return;
+    the<ResourceResolver> resolver(Service::instance().CreateResourceResolver(
+            {"comment_table", "", ".comments.bin"}));
+    const string path = resolver->ResolvePath(dictname_).string();
+    the<CommentTable> table(new CommentTable);
+    if (!table->Open(path))
+        return;
+    commentTableSettings_.fingerprint = index_->fingerprint();
+    if (!table->Matches(commentTableSettings_)) {
+        LOG(WARNING) << "dictionary_lookup_filter: ignoring '" << path
+                     << "', built from another dictionary or with other limits or columns.";
         return;
-
-    if (DictionaryComponent* dictionary = dynamic_cast<DictionaryComponent*>(
-                Dictionary::Require("dictionary"))) {
-        dict_.reset(dictionary->Create(dictname_, dictname_, {}));
-        if (dict_)
-            dict_->Load();
     }
+    LOG(INFO) << "dictionary_lookup_filter: using " << table->size()
+              << " precompiled comments from '" << path << "'.";
+    commentTable_ = std::move(table);
 }
 
 an<Translation> DictionaryLookupFilter::Apply(an<Translation> translation,
                                               CandidateList* candidates) {
     if (!initialized_)
         Initialize();
-    if (!dict_)
+    if (!IndexReady() && !loading_.valid())
         return translation;
+    if (reloadInterval_ > 0 && index_)
+        Reload();
+    if (pool_ || prefetcher_)
+        translation = New<DictionaryLookupBatchTranslation>(translation, this);
     return New<DictionaryLookupFilterTranslation>(translation, this);
 }
 
+void DictionaryLookupFilter::Reload() {
+    // the compiled dictionary is checked at most once per interval; a
+    // finished reload is picked up on the next call
+    const auto now = std::chrono::steady_clock::now();
+    const bool checkSource = now >= nextReloadCheck_;
+    if (checkSource)
+        nextReloadCheck_ = now + std::chrono::seconds(reloadInterval_);
+    an<const LookupIndex> latest =
+        LookupIndexRegistry::instance().Refresh(dictname_, index_, checkSource);
+    if (latest && latest != index_)
+        SetIndex(latest);
+}
+
+size_t DictionaryLookupFilter::BatchSize() const {
+    return engine_ ? std::max(engine_->schema()->page_size(), 1) : 1;
+}
+
+vector<LookupRequest> DictionaryLookupFilter::WordLookups(const CandidateList& candidates) {
+    // sorted and deduplicated by result key; sentence fallbacks are still
+    // looked up as candidates are processed
+    vector<LookupRequest> lookups;
+    for (const an<Candidate>& cand : candidates) {
+        auto phrase = As<Phrase>(Candidate::GetGenuineCandidate(cand));
+        if (!phrase)
+            continue;
+        const string& spellingCode = phrase->comment();
+        const size_t startPos = spellingCode.find('\f');
+        string jyutping = startPos == string::npos ? "" : spellingCode.substr(startPos + 1);
+        boost::remove_erase_if(jyutping, boost::is_any_of("; "));
+        string key = ResultKey(cand->text(), jyutping, false);
+        std::string_view precompiled;
+        if (!cache_.Contains(key) && !batchResults_.count(key) &&
+            !(commentTable_ && commentTable_->Find(key, &precompiled)))
+            lookups.push_back({std::move(key), cand->text(), std::move(jyutping)});
+    }
+    std::sort(lookups.begin(), lookups.end());
+    lookups.erase(std::unique(lookups.begin(), lookups.end()), lookups.end());
+    return lookups;
+}
+
+void DictionaryLookupFilter::AnnotateBatch(const CandidateList& candidates) {
+    if (!pool_ || !IndexReady())
+        return;
+    batchResults_.clear();
+    vector<LookupRequest> lookups = WordLookups(candidates);
+    // finished prefetches need not be looked up again
+    if (prefetcher_) {
+        string result;
+        boost::remove_erase_if(lookups, [&](const LookupRequest& lookup) {
+            if (!prefetcher_->Take(lookup.key, &result))
+                return false;
+            batchResults_[lookup.key] = std::move(result);
+            return true;
+        });
+    }
+
+    vector<string> results(lookups.size());
+    pool_->Run(lookups.size(), [&](size_t worker, size_t i) {
+        results[i] = workerExpanders_[worker]->ParseEntry(
+                lookups[i].honzi, lookups[i].jyutping, false);
+    });
+    for (size_t i = 0; i < lookups.size(); ++i)
+        batchResults_[lookups[i].key] = std::move(results[i]);
+}
+
+void DictionaryLookupFilter::Prefetch(const CandidateList& candidates) {
+    if (prefetcher_ && IndexReady())
+        prefetcher_->Prefetch(WordLookups(candidates));
+}
+
+void DictionaryLookupFilter::CancelPrefetch() {
+    if (prefetcher_)
+        prefetcher_->Cancel();
+}
+
 bool DictionaryLookupFilter::GetWordsFromUserDictEntry(
     const DictEntry entry,
     vector<pair<string, string>>& words,
@@ -384,7 +403,7 @@ bool DictionaryLookupFilter::GetWordsFromUserDictEntry(
     bool success = false;
     if (!entry.elements.empty()) {
         vector<string> syllables;
-        if (dictionary->Decode(entry.code, &syllables)) {
+        if (DecodeSyllables(dictionary, entry.code, &syllables)) {
             size_t i = 0;
             for (const string& element : entry.elements) {
                 string pronunciation;
@@ -401,7 +420,21 @@ bool DictionaryLookupFilter::GetWordsFromUserDictEntry(
 }
 
 void DictionaryLookupFilter::Process(const an<Candidate>& cand) {
-    if (dict_ == nullptr)
+    if (!statistics_) {
+        Annotate(cand);
+        return;
+    }
+    counters_ = LookupCounters();
+    const auto start = std::chrono::steady_clock::now();
+    Annotate(cand);
+    const auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start);
+    statistics_->Record(cand->text(), counters_, cand->comment().size(),
+                        elapsed.count());
+}
+
+void DictionaryLookupFilter::Annotate(const an<Candidate>& cand) {
+    if (!IndexReady())
         return;
     auto phrase = As<Phrase>(Candidate::GetGenuineCandidate(cand));
     if (!phrase)
@@ -435,7 +468,7 @@ void DictionaryLookupFilter::Process(const an<Candidate>& cand) {
                     pronunciation = pronunciation.substr(0, pronunciation.find('\f'));
                 } else if (dictionary) {
                     vector<string> syllables;
-                    if (dictionary->Decode(entry.code, &syllables))
+                    if (DecodeSyllables(dictionary, entry.code, &syllables))
                         pronunciation = boost::join(syllables, "");
                 }
                 words.push_back({entry.text, pronunciation});
@@ -449,7 +482,7 @@ void DictionaryLookupFilter::Process(const an<Candidate>& cand) {
         for (pair<string, string>& word : words) {
             result += word.second;
             if (cache.find(word.first) == cache.end()) {
-              entries += ParseEntry(word.first, word.second, true);
+              entries += ParseWord(word.first, word.second);
               cache.insert(word.first);
             }
         }
@@ -460,9 +493,69 @@ void DictionaryLookupFilter::Process(const an<Candidate>& cand) {
 }
 
 string DictionaryLookupFilter::ParseEntry(string honzi, string jyutping, const bool isSentence) {
-    std::unordered_set<string> activeLookups;
-    return rime::ParseEntry(dict_.get(), honzi, jyutping, isSentence,
-                            activeLookups);
+    boost::remove_erase_if(jyutping, boost::is_any_of("; "));
+    const string cacheKey = ResultKey(honzi, jyutping, isSentence);
+    std::string_view precompiled;
+    if (commentTable_ && commentTable_->Find(cacheKey, &precompiled))
+        return string(precompiled);
+    string result;
+    const auto batched = batchResults_.find(cacheKey);
+    if (batched != batchResults_.end()) {
+        result = batched->second;
+        cache_.Insert(cacheKey, result);
+        return result;
+    }
+    // sentence words are cached by ParseWord() for the composition instead
+    if (isSentence)
+        return expander_.ParseEntry(honzi, jyutping, isSentence);
+    if (prefetcher_ && prefetcher_->Take(cacheKey, &result)) {
+        cache_.Insert(cacheKey, result);
+        return result;
+    }
+    if (cache_.Find(cacheKey, &result))
+        return result;
+    result = expander_.ParseEntry(honzi, jyutping, isSentence);
+    cache_.Insert(cacheKey, result);
+    return result;
+}
+
+string DictionaryLookupFilter::ResultKey(const string& honzi,
+                                         const string& jyutping,
+                                         const bool isSentence) {
+    // isSentence changes the fallback for unmatched entries, so it is part of
+    // the key alongside the normalized honzi + "\f" + jyutping lookup key.
+    return (isSentence ? "1" : "0") + honzi + "\f" + jyutping;
+}
+
+const string& DictionaryLookupFilter::ParseWord(const string& word,
+                                                const string& pronunciation) {
+    const string key = word + "\f" + pronunciation;
+    auto found = wordCache_.find(key);
+    if (found == wordCache_.end())
+        found = wordCache_.emplace(key, ParseEntry(word, pronunciation, true)).first;
+    return found->second;
+}
+
+bool DictionaryLookupFilter::DecodeSyllables(Dictionary* dictionary,
+                                             const Code& code,
+                                             vector<string>* syllables) {
+    if (!dictionary)
+        return false;
+    const auto key = std::make_pair(dictionary, code);
+    auto found = syllableCache_.find(key);
+    if (found == syllableCache_.end()) {
+        vector<string> decoded;
+        const bool success = dictionary->Decode(code, &decoded);
+        found = syllableCache_.emplace(key, std::make_pair(success, decoded)).first;
+    }
+    if (found->second.first)
+        *syllables = found->second.second;
+    return found->second.first;
+}
+
+void DictionaryLookupFilter::ClearCompositionCache() {
+    wordCache_.clear();
+    syllableCache_.clear();
 }
 
 }  // namespace rime
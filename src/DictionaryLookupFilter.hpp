@@ -13,7 +13,18 @@
 #include <rime/algo/algebra.h>
 #include <rime/gear/filter_commons.h>
 #include <rime/ticket.h>
+#include <rime/translation.h>
 #include <rime/dict/dictionary.h>
+#include <chrono>
+#include "CommentTable.hpp"
+#include "FilterStatistics.hpp"
+#include "LookupExpander.hpp"
+#include "LookupIndex.hpp"
+#include "LookupIndexRegistry.hpp"
+#include "LookupPrefetcher.hpp"
+#include "LookupResultCache.hpp"
+#include "LookupWorkerPool.hpp"
+#include "TailProjection.hpp"
 
 namespace rime {
 
@@ -22,6 +33,7 @@ class Dictionary;
 class DictionaryLookupFilter : public Filter, TagMatching {
   public:
     explicit DictionaryLookupFilter(const Ticket& ticket);
+    virtual ~DictionaryLookupFilter();
 
     virtual an<Translation> Apply(an<Translation> translation,
                                   CandidateList* candidates);
@@ -29,18 +41,72 @@ class DictionaryLookupFilter : public Filter, TagMatching {
     virtual bool AppliesToSegment(Segment* segment) { return TagsMatch(segment); }
 
     void Process(const an<Candidate>& cand);
+    // Looks up the candidates of one page on the worker threads; Process()
+    // then picks up the results. Only used with batch_threads set.
+    void AnnotateBatch(const CandidateList& candidates);
+    // Starts looking up candidates of the next page in the background.
+    void Prefetch(const CandidateList& candidates);
+    bool prefetching() const { return prefetcher_ != nullptr; }
+    size_t BatchSize() const;
 
   protected:
     void Initialize();
+    // Adopts the index loaded in the background once it is ready.
+    bool IndexReady();
+    void SetIndex(an<const LookupIndex> index);
+    // Swaps in the dictionary reloaded after its compiled files changed;
+    // only with reload_interval set.
+    void Reload();
+    // Uses <dictionary>.comments.bin from the user data directory when it
+    // was built from the loaded dictionary with the same limits.
+    void OpenCommentTable();
+    void Annotate(const an<Candidate>& cand);
     bool GetWordsFromUserDictEntry(const DictEntry entry,
                                    vector<pair<string, string>>& words,
                                    Dictionary* dictionary);
     string ParseEntry(string honzi, string jyutping, const bool isSentence);
+    static string ResultKey(const string& honzi,
+                            const string& jyutping,
+                            const bool isSentence);
+    // Composition-scoped caches of sentence words and decoded syllables,
+    // dropped on commit or when the context is cleared. Sentence words are
+    // cached only here; the LRU cache keeps the comments of word candidates.
+    const string& ParseWord(const string& word, const string& pronunciation);
+    bool DecodeSyllables(Dictionary* dictionary,
+                         const Code& code,
+                         vector<string>* syllables);
+    void ClearCompositionCache();
+    vector<LookupRequest> WordLookups(const CandidateList& candidates);
+    void CancelPrefetch();
 
     bool initialized_ = false;
-    the<Dictionary> dict_;
+    an<const LookupIndex> index_;
+    an<const TailProjection> projection_;
+    the<CommentTable> commentTable_;
+    CommentTableSettings commentTableSettings_;
+    LookupIndexRegistry::PendingIndex loading_;
+    LookupExpander expander_;
+    LookupResultCache cache_;
+    the<FilterStatistics> statistics_;
+    LookupCounters counters_;
+    the<LookupWorkerPool> pool_;
+    vector<the<LookupExpander>> workerExpanders_;
+    hash_map<string, string> batchResults_;
+    the<LookupPrefetcher> prefetcher_;
+    string prefetchInput_;
+    hash_map<string, string> wordCache_;
+    map<pair<Dictionary*, Code>, pair<bool, vector<string>>> syllableCache_;
+    connection commitConnection_;
+    connection updateConnection_;
     // settings
     string dictname_;
+    bool asyncLoad_ = false;
+    bool lookupOnly_ = false;
+    int reloadInterval_ = 0;
+    // matched_columns and unmatched_columns; empty for compact output,
+    // which has no tails
+    LookupIndexRegistry::TailColumns tailColumns_;
+    std::chrono::steady_clock::time_point nextReloadCheck_;
 };
 };  // namespace rime
 
@@ -0,0 +1,90 @@
+//
+//  FilterStatistics.cpp
+//  rime-dictionary-lookup-filter-objs
+//
+
+#include "FilterStatistics.hpp"
+
+#include <algorithm>
+#include <sstream>
+
+namespace rime {
+
+void Histogram::Add(uint64_t value) {
+    size_t bucket = 0;
+    while (bucket + 1 < kBuckets && (uint64_t(1) << bucket) <= value)
+        ++bucket;
+    ++buckets_[bucket];
+    ++count_;
+    sum_ += value;
+    if (value > max_)
+        max_ = value;
+}
+
+// upper bound of the bucket holding the given percentile
+uint64_t Histogram::Percentile(double p) const {
+    const uint64_t rank = count_ ? uint64_t(p * (count_ - 1)) : 0;
+    uint64_t seen = 0;
+    for (size_t bucket = 0; bucket < kBuckets; ++bucket) {
+        seen += buckets_[bucket];
+        if (seen > rank)
+            return std::min(uint64_t(1) << bucket, max_);
+    }
+    return max_;
+}
+
+string Histogram::ToString() const {
+    std::ostringstream out;
+    out << "mean=" << (count_ ? double(sum_) / count_ : 0.0)
+        << " p50<=" << Percentile(0.5) << " p90<=" << Percentile(0.9)
+        << " p99<=" << Percentile(0.99) << " max=" << max_;
+    return out.str();
+}
+
+void FilterStatistics::Outlier::Update(uint64_t newValue, const string& newText) {
+    if (newValue <= value)
+        return;
+    value = newValue;
+    text = newText;
+}
+
+void FilterStatistics::Record(const string& text,
+                              const LookupCounters& counters,
+                              size_t commentBytes,
+                              uint64_t processMicros) {
+    ++candidates_;
+    lookups_.Add(counters.lookups);
+    rowsScanned_.Add(counters.rowsScanned);
+    depth_.Add(counters.maxDepth);
+    rowsEmitted_.Add(counters.rowsEmitted);
+    rowsDropped_.Add(counters.rowsDropped);
+    commentBytes_.Add(commentBytes);
+    if (counters.truncations > 0)
+        ++truncated_;
+    processMicros_.Add(processMicros);
+    slowest_.Update(processMicros, text);
+    largest_.Update(commentBytes, text);
+    deepest_.Update(counters.maxDepth, text);
+    if (interval_ > 0 && ++sinceDump_ >= interval_)
+        Dump();
+}
+
+void FilterStatistics::Dump() {
+    sinceDump_ = 0;
+    if (candidates_ == 0)
+        return;
+    LOG(INFO) << name_ << " statistics over " << candidates_ << " candidates:"
+              << "\n  lookups: " << lookups_.ToString()
+              << "\n  rows scanned: " << rowsScanned_.ToString()
+              << "\n  recursion depth: " << depth_.ToString()
+              << "\n  rows emitted: " << rowsEmitted_.ToString()
+              << "\n  rows dropped by dedupe: " << rowsDropped_.ToString()
+              << "\n  comment bytes: " << commentBytes_.ToString()
+              << "\n  truncated by budget: " << truncated_ << " candidates"
+              << "\n  Process() us: " << processMicros_.ToString()
+              << "\n  slowest: '" << slowest_.text << "' (" << slowest_.value << " us)"
+              << "\n  largest: '" << largest_.text << "' (" << largest_.value << " bytes)"
+              << "\n  deepest: '" << deepest_.text << "' (depth " << deepest_.value << ")";
+}
+
+}  // namespace rime
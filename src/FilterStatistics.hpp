@@ -0,0 +1,80 @@
+//
+//  FilterStatistics.hpp
+//  rime-dictionary-lookup-filter-objs
+//
+
+#ifndef FilterStatistics_hpp
+#define FilterStatistics_hpp
+
+#include <rime/common.h>
+#include <cstdint>
+
+namespace rime {
+
+// Work done by LookupExpander, accumulated over the lookups of one candidate.
+struct LookupCounters {
+    size_t lookups = 0;
+    size_t rowsScanned = 0;
+    size_t maxDepth = 0;
+    size_t rowsEmitted = 0;
+    size_t rowsDropped = 0;
+    // lookups cut short by the work budget
+    size_t truncations = 0;
+};
+
+// Power-of-two bucketed histogram.
+class Histogram {
+  public:
+    void Add(uint64_t value);
+    string ToString() const;
+
+  private:
+    uint64_t Percentile(double p) const;
+
+    static const size_t kBuckets = 40;
+    uint64_t buckets_[kBuckets] = {};
+    uint64_t count_ = 0;
+    uint64_t sum_ = 0;
+    uint64_t max_ = 0;
+};
+
+// Per-candidate statistics of the filter pipeline, dumped to the log every
+// `interval` candidates and on teardown.
+class FilterStatistics {
+  public:
+    FilterStatistics(const string& name, size_t interval)
+            : name_(name), interval_(interval) {}
+    ~FilterStatistics() { Dump(); }
+
+    void Record(const string& text,
+                const LookupCounters& counters,
+                size_t commentBytes,
+                uint64_t processMicros);
+    void Dump();
+
+  private:
+    struct Outlier {
+        uint64_t value = 0;
+        string text;
+        void Update(uint64_t newValue, const string& newText);
+    };
+
+    string name_;
+    size_t interval_;
+    size_t candidates_ = 0;
+    size_t sinceDump_ = 0;
+    size_t truncated_ = 0;
+    Histogram lookups_;
+    Histogram rowsScanned_;
+    Histogram depth_;
+    Histogram rowsEmitted_;
+    Histogram rowsDropped_;
+    Histogram commentBytes_;
+    Histogram processMicros_;
+    Outlier slowest_;
+    Outlier largest_;
+    Outlier deepest_;
+};
+};  // namespace rime
+
+#endif /* FilterStatistics_hpp */
@@ -0,0 +1,48 @@
+//
+//  LookupArena.cpp
+//  rime-dictionary-lookup-filter-objs
+//
+
+#include "LookupArena.hpp"
+
+#include <algorithm>
+
+namespace rime {
+
+void* LookupArena::Allocate(size_t size, size_t alignment) {
+    size_t padding =
+        cursor_ ? (alignment - reinterpret_cast<uintptr_t>(cursor_) % alignment) % alignment : 0;
+    if (!cursor_ || size + padding > size_t(end_ - cursor_)) {
+        AddBlock(size + alignment);
+        padding = (alignment - reinterpret_cast<uintptr_t>(cursor_) % alignment) % alignment;
+    }
+    char* result = cursor_ + padding;
+    cursor_ = result + size;
+    return result;
+}
+
+void LookupArena::Reset() {
+    if (blocks_.size() > 1) {
+        // the last lookup spilled over; next time serve it from one block
+        blockSize_ = std::max(blockSize_, used_ + size_t(cursor_ - blocks_.back().get()));
+        blocks_.clear();
+    }
+    used_ = 0;
+    if (blocks_.empty()) {
+        cursor_ = end_ = nullptr;
+        return;
+    }
+    cursor_ = blocks_.back().get();
+    end_ = cursor_ + lastBlockSize_;
+}
+
+void LookupArena::AddBlock(size_t minSize) {
+    if (!blocks_.empty())
+        used_ += cursor_ - blocks_.back().get();
+    lastBlockSize_ = std::max(blockSize_, minSize);
+    blocks_.emplace_back(new char[lastBlockSize_]);
+    cursor_ = blocks_.back().get();
+    end_ = cursor_ + lastBlockSize_;
+}
+
+}  // namespace rime
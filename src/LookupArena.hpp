@@ -0,0 +1,66 @@
+//
+//  LookupArena.hpp
+//  rime-dictionary-lookup-filter-objs
+//
+
+#ifndef LookupArena_hpp
+#define LookupArena_hpp
+
+#include <rime/common.h>
+#include <cstddef>
+#include <cstdint>
+
+namespace rime {
+
+// Monotonic bump allocator for the short-lived strings and row vectors of
+// one lookup. Reset() releases everything at once and keeps the memory, so
+// a warmed-up arena serves a lookup without touching the heap.
+class LookupArena {
+  public:
+    explicit LookupArena(size_t blockSize = 64 * 1024) : blockSize_(blockSize) {}
+    LookupArena(const LookupArena&) = delete;
+    LookupArena& operator=(const LookupArena&) = delete;
+
+    void* Allocate(size_t size, size_t alignment);
+    void Reset();
+
+  private:
+    void AddBlock(size_t minSize);
+
+    size_t blockSize_;
+    vector<the<char[]>> blocks_;
+    size_t lastBlockSize_ = 0;
+    size_t used_ = 0;  // bytes handed out from all blocks but the last
+    char* cursor_ = nullptr;
+    char* end_ = nullptr;
+};
+
+template <class T>
+class ArenaAllocator {
+  public:
+    typedef T value_type;
+
+    ArenaAllocator(LookupArena* arena) : arena_(arena) {}
+    template <class U>
+    ArenaAllocator(const ArenaAllocator<U>& other) : arena_(other.arena()) {}
+
+    T* allocate(size_t n) {
+        return static_cast<T*>(arena_->Allocate(n * sizeof(T), alignof(T)));
+    }
+    void deallocate(T*, size_t) {}
+    LookupArena* arena() const { return arena_; }
+
+    template <class U>
+    bool operator==(const ArenaAllocator<U>& other) const { return arena_ == other.arena(); }
+    template <class U>
+    bool operator!=(const ArenaAllocator<U>& other) const { return arena_ != other.arena(); }
+
+  private:
+    LookupArena* arena_;
+};
+
+template <class T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+};  // namespace rime
+
+#endif /* LookupArena_hpp */
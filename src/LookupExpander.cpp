@@ -0,0 +1,491 @@
+//
+//  LookupExpander.cpp
+//  rime-dictionary-lookup-filter-objs
+//
+
+#include "LookupExpander.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <limits>
+
+namespace rime {
+
+namespace {
+
+// Open-addressing table from row dedupe ids to positions, sized for the
+// rows of one lookup and allocated from its arena.
+class DedupeTable {
+  public:
+    DedupeTable(LookupArena& arena, size_t expected) {
+        while (capacity_ < expected * 2)
+            capacity_ *= 2;
+        slots_ = static_cast<Slot*>(arena.Allocate(capacity_ * sizeof(Slot), alignof(Slot)));
+        for (size_t i = 0; i < capacity_; ++i)
+            slots_[i].id = kEmpty;
+    }
+
+    size_t* Find(uint32_t id) const {
+        Slot& slot = Probe(id);
+        return slot.id == id ? &slot.position : nullptr;
+    }
+    // Returns true if the id was not in the table yet.
+    bool Insert(uint32_t id, size_t position) {
+        Slot& slot = Probe(id);
+        const bool inserted = slot.id == kEmpty;
+        slot.id = id;
+        slot.position = position;
+        return inserted;
+    }
+
+  private:
+    struct Slot {
+        uint32_t id;
+        size_t position;
+    };
+    static const uint32_t kEmpty = std::numeric_limits<uint32_t>::max();
+
+    Slot& Probe(uint32_t id) const {
+        size_t i = (id * 0x9E3779B1u) & (capacity_ - 1);
+        while (slots_[i].id != kEmpty && slots_[i].id != id)
+            i = (i + 1) & (capacity_ - 1);
+        return slots_[i];
+    }
+
+    size_t capacity_ = 8;
+    Slot* slots_;
+};
+
+// "\r1#" and a row id of up to 7 digits
+const size_t kRowReferenceLength = 10;
+// "\r@" and 16 hex digits of the index fingerprint
+const size_t kFingerprintTagLength = 18;
+
+}  // namespace
+
+const char LookupExpander::kTruncationMarker[] = "\r~,truncated";
+
+bool LookupExpander::LookupLines(std::string_view honzi,
+                                 std::string_view jyutping,
+                                 LookupRows& matchedLines,
+                                 LookupRows& remainingLines) {
+    const LookupEntry* entry = index_->Find(honzi);
+    ++lookupCount_;
+    if (counters_)
+        ++counters_->lookups;
+    if (!entry)
+        return false;
+    ArenaVector<std::string_view> pronunciations(&arena_);
+    size_t start = 0;
+    while (true) {
+        const size_t end = jyutping.find('\f', start);
+        pronunciations.push_back(jyutping.substr(start, end - start));
+        if (end == std::string_view::npos)
+            break;
+        start = end + 1;
+    }
+    index_->Split(*entry, pronunciations, matchedLines, remainingLines);
+    if (counters_)
+        counters_->rowsScanned += entry->rowCount;
+    return true;
+}
+
+void LookupExpander::Reset(const LookupIndex* index, const TailProjection* projection) {
+    index_ = index;
+    projection_ = projection;
+    memo_.clear();
+}
+
+std::string_view LookupExpander::Normalize(std::string_view jyutping) {
+    if (jyutping.find_first_of("; ") == std::string_view::npos)
+        return jyutping;
+    char* normalized = static_cast<char*>(arena_.Allocate(jyutping.size(), 1));
+    size_t length = 0;
+    for (const char c : jyutping) {
+        if (c != ';' && c != ' ')
+            normalized[length++] = c;
+    }
+    return std::string_view(normalized, length);
+}
+
+std::string_view LookupExpander::LookupKey(std::string_view honzi,
+                                           std::string_view jyutping) {
+    char* key = static_cast<char*>(arena_.Allocate(honzi.size() + 1 + jyutping.size(), 1));
+    std::memcpy(key, honzi.data(), honzi.size());
+    key[honzi.size()] = '\f';
+    std::memcpy(key + honzi.size() + 1, jyutping.data(), jyutping.size());
+    return std::string_view(key, honzi.size() + 1 + jyutping.size());
+}
+
+bool LookupExpander::CutsCycle(std::string_view lookupKey) {
+    if (capacity_ > 0)
+        visitLog_.push_back(lookupKey);
+    const auto active = std::find(activeLookups_.begin(), activeLookups_.end(), lookupKey);
+    if (active == activeLookups_.end())
+        return false;
+    cutDepth_ = std::min(cutDepth_, size_t(active - activeLookups_.begin()));
+    return true;
+}
+
+bool LookupExpander::WithinBudget(const size_t depth) {
+    if (budget_.maxDepth > 0 && depth > budget_.maxDepth) {
+        Truncate(kDepthLimit);
+        return false;
+    }
+    if (budget_.maxLookups > 0 && lookupCount_ >= budget_.maxLookups) {
+        Truncate(kLookupLimit);
+        return false;
+    }
+    return true;
+}
+
+size_t LookupExpander::Enter(std::string_view lookupKey) {
+    activeLookups_.push_back(lookupKey);
+    return activeLookups_.size() - 1;
+}
+
+void LookupExpander::Leave() {
+    activeLookups_.pop_back();
+}
+
+const string& LookupExpander::MemoKey(std::string_view lookupKey, const char flags[3]) {
+    memoKey_.assign(lookupKey.data(), lookupKey.size());
+    memoKey_ += '\f';
+    memoKey_.append(flags, 3);
+    return memoKey_;
+}
+
+const LookupExpander::Expansion* LookupExpander::FindExpansion(std::string_view lookupKey,
+                                                               const char flags[3],
+                                                               const size_t depth) {
+    if (capacity_ == 0)
+        return nullptr;
+    const auto found = memo_.find(MemoKey(lookupKey, flags));
+    if (found == memo_.end()) {
+        ++misses_;
+        return nullptr;
+    }
+    // Expanding afresh would have run out of budget, and its truncated
+    // output differs from the memoized one.
+    const Expansion& expansion = found->second;
+    if ((budget_.maxDepth > 0 && depth + expansion.height > budget_.maxDepth) ||
+        (budget_.maxLookups > 0 &&
+         lookupCount_ + expansion.lookups > budget_.maxLookups)) {
+        ++misses_;
+        return nullptr;
+    }
+    // A cycle through an active key would have been cut differently.
+    for (const string& key : found->second.visitedKeys) {
+        if (std::find(activeLookups_.begin(), activeLookups_.end(), key) !=
+            activeLookups_.end()) {
+            ++misses_;
+            return nullptr;
+        }
+    }
+    ++hits_;
+    for (const string& key : expansion.visitedKeys)
+        visitLog_.push_back(key);
+    // charged as if expanded afresh
+    lookupCount_ += expansion.lookups;
+    depthReached_ = std::max(depthReached_, depth + expansion.height);
+    return &expansion;
+}
+
+void LookupExpander::SaveExpansion(std::string_view lookupKey,
+                                   const char flags[3],
+                                   const EmittedLines& rows,
+                                   const size_t rowStart,
+                                   const size_t visitStart,
+                                   const size_t lookups,
+                                   const size_t height) {
+    // Existing entries stay: visitLog_ may point into them, and they hold
+    // the same rows.
+    if (capacity_ == 0 || memo_.count(MemoKey(lookupKey, flags)))
+        return;
+    Expansion& expansion = memo_[memoKey_];
+    expansion.rows.assign(rows.begin() + rowStart, rows.end());
+    vector<std::string_view> visitedKeys(visitLog_.begin() + visitStart, visitLog_.end());
+    std::sort(visitedKeys.begin(), visitedKeys.end());
+    visitedKeys.erase(std::unique(visitedKeys.begin(), visitedKeys.end()), visitedKeys.end());
+    expansion.visitedKeys.assign(visitedKeys.begin(), visitedKeys.end());
+    expansion.lookups = lookups;
+    expansion.height = height;
+}
+
+EmittedLines LookupExpander::DeduplicateRows(const EmittedLines& rows,
+                                             const EmittedLines* skippedRows) {
+    DedupeTable skipped(arena_, skippedRows ? skippedRows->size() : 0);
+    if (skippedRows) {
+        for (const EmittedLine& line : *skippedRows)
+            skipped.Insert(line.row->dedupeId, 0);
+    }
+    // last collected position of each dedupe id
+    DedupeTable lastIndex(arena_, rows.size());
+    for (size_t i = 0; i < rows.size(); ++i) {
+        const uint32_t id = rows[i].row->dedupeId;
+        if (skipped.Find(id))
+            continue;
+#ifndef NDEBUG
+        if (const size_t* previous = lastIndex.Find(id))
+            assert(index_->DedupeKey(*rows[*previous].row) ==
+                   index_->DedupeKey(*rows[i].row));
+#endif
+        lastIndex.Insert(id, i);
+    }
+    EmittedLines result(&arena_);
+    for (size_t i = 0; i < rows.size(); ++i) {
+        const size_t* last = lastIndex.Find(rows[i].row->dedupeId);
+        if (last && *last == i)
+            result.push_back(rows[i]);
+    }
+    return result;
+}
+
+void LookupExpander::AppendCanonicalRedirects(EmittedLines& rows,
+                                              const LookupRow& line,
+                                              const char componentMatchInputBuffer,
+                                              const bool includeComponentEntries) {
+    const LookupIndex& index = *index_;
+    if (line.columnCount <= 4 ||
+        (index.Column(line, 3).empty() && index.Column(line, 4).empty()))
+        return;
+
+    const std::string_view canonicalHonzi = index.Column(line, 3).empty()
+                                            ? index.LookupHonzi(line)
+                                            : index.Column(line, 3);
+    const std::string_view canonicalJyutping = index.Column(line, 4).empty()
+                                               ? index.Column(line, 0)
+                                               : index.Column(line, 4);
+    CollectMatchedRows(rows, canonicalHonzi, canonicalJyutping, '0',
+                       componentMatchInputBuffer, includeComponentEntries);
+}
+
+void LookupExpander::AppendCanonicalEntryOrRedirect(EmittedLines& rows,
+                                                    const LookupRow& line,
+                                                    const char matchInputBuffer,
+                                                    const char componentMatchInputBuffer,
+                                                    const bool includeComponentEntries) {
+    const LookupIndex& index = *index_;
+    if (line.columnCount > 4 && index.Column(line, 3).empty() &&
+        index.Column(line, 4).empty()) {
+        rows.push_back({&line, matchInputBuffer});
+        return;
+    }
+    AppendCanonicalRedirects(rows, line, componentMatchInputBuffer,
+                             includeComponentEntries);
+}
+
+void LookupExpander::AppendLineWithRelatedEntries(EmittedLines& rows,
+                                                  const LookupRow& line,
+                                                  const char matchInputBuffer,
+                                                  const char componentMatchInputBuffer,
+                                                  const bool includeComponentEntries) {
+    const LookupIndex& index = *index_;
+    rows.push_back({&line, matchInputBuffer});
+
+    // Related rows are collected immediately after their parent row;
+    // later deduplication may keep a duplicate at its last collected position.
+    AppendCanonicalRedirects(rows, line, componentMatchInputBuffer,
+                             includeComponentEntries);
+
+    if (!includeComponentEntries || line.columnCount <= 6 ||
+        index.Column(line, 5).empty() || index.Column(line, 6).empty())
+        return;
+
+    const size_t componentCount =
+            std::min(index.FieldCount(line, 5), index.FieldCount(line, 6));
+    for (size_t i = 0; i < componentCount; ++i) {
+        const std::string_view componentText = index.Field(line, 5, i);
+        const std::string_view componentJyutping = index.Field(line, 6, i);
+        if (componentText.empty() || componentJyutping.empty())
+            continue;
+        CollectMatchedRows(rows, componentText, componentJyutping,
+                           componentMatchInputBuffer, componentMatchInputBuffer,
+                           includeComponentEntries);
+    }
+}
+
+void LookupExpander::CollectMatchedRows(EmittedLines& rows,
+                                        std::string_view honzi,
+                                        std::string_view jyutping,
+                                        const char matchInputBuffer,
+                                        const char componentMatchInputBuffer,
+                                        const bool includeComponentEntries) {
+    jyutping = Normalize(jyutping);
+    const std::string_view lookupKey = LookupKey(honzi, jyutping);
+    if (CutsCycle(lookupKey))
+        return;
+    const char flags[3] = {matchInputBuffer, componentMatchInputBuffer,
+                           includeComponentEntries ? '1' : '0'};
+    if (const Expansion* expansion =
+            FindExpansion(lookupKey, flags, activeLookups_.size())) {
+        rows.insert(rows.end(), expansion->rows.begin(), expansion->rows.end());
+        return;
+    }
+    if (!WithinBudget(activeLookups_.size()))
+        return;
+
+    const size_t depth = Enter(lookupKey);
+    if (counters_)
+        counters_->maxDepth = std::max(counters_->maxDepth, depth);
+    const size_t rowStart = rows.size();
+    const size_t visitStart = visitLog_.empty() ? 0 : visitLog_.size() - 1;
+    const size_t outerCutDepth = cutDepth_;
+    cutDepth_ = std::numeric_limits<size_t>::max();
+    const size_t lookupStart = lookupCount_;
+    const size_t outerDepthReached = depthReached_;
+    depthReached_ = depth;
+    const unsigned outerTruncated = truncated_;
+    truncated_ = 0;
+
+    LookupRows matchedLines(&arena_), remainingLines(&arena_);
+    if (LookupLines(honzi, jyutping, matchedLines, remainingLines)) {
+        for (const LookupRow* line : matchedLines)
+            AppendLineWithRelatedEntries(rows, *line, matchInputBuffer,
+                                         componentMatchInputBuffer,
+                                         includeComponentEntries);
+    }
+
+    // Subtrees that were cut at an ancestor depend on the lookup path, and
+    // truncated ones on the budget left.
+    if (cutDepth_ >= depth && !truncated_)
+        SaveExpansion(lookupKey, flags, rows, rowStart, visitStart,
+                      lookupCount_ - lookupStart, depthReached_ - depth);
+    cutDepth_ = std::min(cutDepth_, outerCutDepth);
+    depthReached_ = std::max(depthReached_, outerDepthReached);
+    truncated_ |= outerTruncated;
+    Leave();
+}
+
+string LookupExpander::ParseEntry(std::string_view honzi,
+                                  std::string_view jyutping,
+                                  const bool isSentence) {
+    if (!index_)
+        return "";
+    arena_.Reset();
+    activeLookups_.clear();
+    visitLog_.clear();
+    cutDepth_ = std::numeric_limits<size_t>::max();
+    lookupCount_ = 0;
+    depthReached_ = 0;
+    truncated_ = 0;
+    // deferred to here, as visitLog_ may point into memoized entries
+    if (memo_.size() > capacity_)
+        memo_.clear();
+
+    jyutping = Normalize(jyutping);
+    Enter(LookupKey(honzi, jyutping));
+
+    LookupRows matchedLines(&arena_), remainingLines(&arena_);
+    if (!LookupLines(honzi, jyutping, matchedLines, remainingLines)) {
+        Leave();
+        return "";
+    }
+
+    // Emission rules:
+    // - Direct pronunciation matches and their component entries use
+    //   match_input_buffer=1, so they appear in both candidate selection and
+    //   dictionary panels.
+    // - Canonical redirects use match_input_buffer=0 even when collected while
+    //   building the 1 group. Empty canonical columns mean the row is already
+    //   canonical.
+    // - If there are no direct matches for a non-sentence lookup, unmatched
+    //   dictionary rows and their related entries are used as the fallback 1 group.
+    // - If direct matches exist, unmatched canonical rows are kept with 0;
+    //   unmatched noncanonical rows are kept only through their 0 canonical
+    //   redirects.
+    // - Deduplication ignores match_input_buffer and pronOrder, keeps the last
+    //   collected position within each group, and lets the 1 group win over the
+    //   0 group.
+    // - pronOrder is not emitted; it only sorts within one honzi lookup.
+    //   Related canonical/component lookups keep discovery order across honzi.
+    EmittedLines candidateAndDictionaryRows(&arena_), dictionaryOnlyRows(&arena_);
+    const bool hasOnlyUnmatchedWordEntries =
+        !isSentence && matchedLines.empty() && !remainingLines.empty();
+    if (hasOnlyUnmatchedWordEntries) {
+        for (const LookupRow* line : remainingLines)
+            AppendLineWithRelatedEntries(candidateAndDictionaryRows, *line,
+                                         '1', '1', true);
+    } else {
+        for (const LookupRow* line : matchedLines)
+            AppendLineWithRelatedEntries(candidateAndDictionaryRows, *line,
+                                         '1', '1', true);
+        for (const LookupRow* line : remainingLines)
+            AppendCanonicalEntryOrRedirect(dictionaryOnlyRows, *line,
+                                           '0', '0', false);
+    }
+
+    const size_t collectedRows =
+        candidateAndDictionaryRows.size() + dictionaryOnlyRows.size();
+    candidateAndDictionaryRows = DeduplicateRows(candidateAndDictionaryRows);
+    dictionaryOnlyRows = DeduplicateRows(dictionaryOnlyRows, &candidateAndDictionaryRows);
+    if (counters_) {
+        const size_t emittedRows =
+            candidateAndDictionaryRows.size() + dictionaryOnlyRows.size();
+        counters_->rowsEmitted += emittedRows;
+        counters_->rowsDropped += collectedRows - emittedRows;
+    }
+
+    // Rows beyond the row or byte limit are dropped in emission order, so
+    // the 1 group is kept first.
+    size_t emittedRows = 0;
+    size_t length = 0;
+    bool full = false;
+    for (const EmittedLines* group : {&candidateAndDictionaryRows, &dictionaryOnlyRows}) {
+        for (const EmittedLine& line : *group) {
+            // measured on the lines as written out; compact output measures
+            // full lines, so it resolves to the same rows
+            const size_t lineLength = index_->CommentLineLength(
+                    *line.row, TailOf(*line.row, line.matchInputBuffer));
+            if (budget_.maxRows > 0 && emittedRows >= budget_.maxRows) {
+                Truncate(kRowLimit);
+                full = true;
+            } else if (budget_.maxBytes > 0 && length + lineLength > budget_.maxBytes) {
+                Truncate(kByteLimit);
+                full = true;
+            }
+            if (full)
+                break;
+            ++emittedRows;
+            length += lineLength;
+        }
+        if (full)
+            break;
+    }
+    for (size_t limit = 0; limit < kLookupLimitCount; ++limit) {
+        if (truncated_ & (1u << limit))
+            ++truncations_[limit];
+    }
+    if (counters_ && truncated_)
+        ++counters_->truncations;
+
+    // the comment is written once into a buffer of its final size
+    string result;
+    result.reserve((compact_ ? kFingerprintTagLength + emittedRows * kRowReferenceLength
+                             : length) +
+                   (truncated_ ? sizeof(kTruncationMarker) - 1 : 0));
+    // references name the index they resolve against
+    if (compact_ && emittedRows > 0)
+        index_->AppendFingerprintTag(result);
+    // rows past the limit are dropped from both groups
+    size_t remaining = emittedRows;
+    for (const EmittedLines* group : {&candidateAndDictionaryRows, &dictionaryOnlyRows}) {
+        for (const EmittedLine& line : *group) {
+            if (remaining == 0)
+                break;
+            --remaining;
+            if (compact_)
+                index_->AppendRowReference(result, *line.row, line.matchInputBuffer);
+            else
+                index_->AppendCommentLine(result, *line.row, line.matchInputBuffer,
+                                          TailOf(*line.row, line.matchInputBuffer));
+        }
+    }
+    if (truncated_)
+        result += kTruncationMarker;
+    Leave();
+    return result;
+}
+
+}  // namespace rime
@@ -0,0 +1,170 @@
+//
+//  LookupExpander.hpp
+//  rime-dictionary-lookup-filter-objs
+//
+
+#ifndef LookupExpander_hpp
+#define LookupExpander_hpp
+
+#include <rime/common.h>
+#include <string_view>
+#include "FilterStatistics.hpp"
+#include "LookupArena.hpp"
+#include "LookupIndex.hpp"
+#include "TailProjection.hpp"
+
+namespace rime {
+
+// A collected row; its comment line is only written out once all rows are
+// collected and deduplicated.
+struct EmittedLine {
+    const LookupRow* row;
+    char matchInputBuffer;
+};
+
+typedef ArenaVector<EmittedLine> EmittedLines;
+typedef ArenaVector<const LookupRow*> LookupRows;
+
+// Limits on the work done for one ParseEntry call; 0 means unlimited.
+// Depth and lookups bound the recursion through canonical and component
+// entries, rows and bytes bound the comment written out.
+struct LookupBudget {
+    size_t maxDepth = 0;
+    size_t maxLookups = 0;
+    size_t maxRows = 0;
+    size_t maxBytes = 0;
+};
+
+// limits used unless configured otherwise
+const size_t kDefaultMaxDepth = 16;
+const size_t kDefaultMaxLookups = 512;
+const size_t kDefaultMaxRows = 512;
+const size_t kDefaultMaxBytes = 65536;
+
+enum LookupLimit {
+    kDepthLimit,
+    kLookupLimit,
+    kRowLimit,
+    kByteLimit,
+    kLookupLimitCount
+};
+
+// Expands dictionary rows into comment lines, following canonical redirects
+// and component entries. Expanded subtrees are memoized by
+// (honzi, jyutping, matchInputBuffer, componentMatchInputBuffer,
+// includeComponentEntries) and shared between word and sentence lookups.
+// Intermediate keys and row vectors of one lookup live in an arena.
+class LookupExpander {
+  public:
+    // Appended as the last comment line when a budget limit cut the output.
+    static const char kTruncationMarker[];
+
+    explicit LookupExpander(size_t capacity = 0) : capacity_(capacity) {}
+
+    // Drops all memoized subtrees; must be called when the index changes.
+    // The projection, built for the same index, trims the tails of comment
+    // lines; compact output ignores it, as row references resolve to full
+    // rows.
+    void Reset(const LookupIndex* index, const TailProjection* projection = nullptr);
+    string ParseEntry(std::string_view honzi,
+                      std::string_view jyutping,
+                      const bool isSentence);
+
+    size_t capacity() const { return capacity_; }
+    void set_capacity(size_t capacity) { capacity_ = capacity; }
+    size_t hits() const { return hits_; }
+    size_t misses() const { return misses_; }
+    // Work counters are only collected while set.
+    void set_counters(LookupCounters* counters) { counters_ = counters; }
+    void set_budget(const LookupBudget& budget) { budget_ = budget; }
+    // Emits row references instead of full comment lines.
+    void set_compact(bool compact) { compact_ = compact; }
+    // Number of ParseEntry calls truncated by the given limit.
+    size_t truncations(LookupLimit limit) const { return truncations_[limit]; }
+
+  protected:
+    struct Expansion {
+        vector<EmittedLine> rows;
+        // every lookup key checked while expanding the subtree; the
+        // expansion is reusable only while none of them is active
+        vector<string> visitedKeys;
+        // budget the subtree needs: lookups done and depth below its root
+        size_t lookups;
+        size_t height;
+    };
+
+    std::string_view Normalize(std::string_view jyutping);
+    std::string_view LookupKey(std::string_view honzi, std::string_view jyutping);
+    bool LookupLines(std::string_view honzi,
+                     std::string_view jyutping,
+                     LookupRows& matchedLines,
+                     LookupRows& remainingLines);
+    bool CutsCycle(std::string_view lookupKey);
+    bool WithinBudget(const size_t depth);
+    std::string_view TailOf(const LookupRow& row, const char matchInputBuffer) const {
+        return projection_ && !compact_ ? projection_->Tail(row, matchInputBuffer)
+                                        : index_->Tail(row);
+    }
+    void Truncate(LookupLimit limit) { truncated_ |= 1u << limit; }
+    size_t Enter(std::string_view lookupKey);
+    void Leave();
+    const string& MemoKey(std::string_view lookupKey, const char flags[3]);
+    const Expansion* FindExpansion(std::string_view lookupKey,
+                                   const char flags[3],
+                                   const size_t depth);
+    void SaveExpansion(std::string_view lookupKey,
+                       const char flags[3],
+                       const EmittedLines& rows,
+                       const size_t rowStart,
+                       const size_t visitStart,
+                       const size_t lookups,
+                       const size_t height);
+    EmittedLines DeduplicateRows(const EmittedLines& rows,
+                                 const EmittedLines* skippedRows = nullptr);
+
+    void CollectMatchedRows(EmittedLines& rows,
+                            std::string_view honzi,
+                            std::string_view jyutping,
+                            const char matchInputBuffer,
+                            const char componentMatchInputBuffer,
+                            const bool includeComponentEntries);
+    void AppendCanonicalRedirects(EmittedLines& rows,
+                                  const LookupRow& line,
+                                  const char componentMatchInputBuffer,
+                                  const bool includeComponentEntries);
+    void AppendCanonicalEntryOrRedirect(EmittedLines& rows,
+                                        const LookupRow& line,
+                                        const char matchInputBuffer,
+                                        const char componentMatchInputBuffer,
+                                        const bool includeComponentEntries);
+    void AppendLineWithRelatedEntries(EmittedLines& rows,
+                                      const LookupRow& line,
+                                      const char matchInputBuffer,
+                                      const char componentMatchInputBuffer,
+                                      const bool includeComponentEntries);
+
+    const LookupIndex* index_ = nullptr;
+    const TailProjection* projection_ = nullptr;
+    size_t capacity_;
+    hash_map<string, Expansion> memo_;
+    string memoKey_;
+    size_t hits_ = 0;
+    size_t misses_ = 0;
+    LookupCounters* counters_ = nullptr;
+    LookupBudget budget_;
+    bool compact_ = false;
+    size_t truncations_[kLookupLimitCount] = {};
+    // per-lookup state: the arena, active lookup keys (their position is the
+    // recursion depth), the shallowest active key a cycle was cut at, all
+    // keys checked so far, and the budget spent and limits hit so far
+    LookupArena arena_;
+    vector<std::string_view> activeLookups_;
+    size_t cutDepth_ = 0;
+    vector<std::string_view> visitLog_;
+    size_t lookupCount_ = 0;
+    size_t depthReached_ = 0;
+    unsigned truncated_ = 0;
+};
+};  // namespace rime
+
+#endif /* LookupExpander_hpp */
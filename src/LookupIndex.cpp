@@ -0,0 +1,509 @@
+//
+//  LookupIndex.cpp
+//  rime-dictionary-lookup-filter-objs
+//
+
+#include "LookupIndex.hpp"
+#include "RowTokenizer.hpp"
+
+#include <rime/dict/dictionary.h>
+#include <rime/dict/table.h>
+#include <algorithm>
+#include <charconv>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+namespace rime {
+
+namespace {
+
+struct ParsedRow {
+    string line;
+    uint32_t columnEnds[7];
+    uint32_t columnCount;
+    int32_t pronOrder;
+    // '|' positions in columns 5 and 6, in order
+    vector<uint32_t> pipes;
+    uint32_t pipeCounts[2] = {};
+};
+
+// A malformed pronOrder sorts like an empty one rather than failing the
+// whole dictionary.
+int32_t ParsePronOrder(std::string_view text, std::string_view rawLine) {
+    const size_t start = text.find_first_not_of(" \t");
+    if (start == std::string_view::npos)
+        return 0;
+    int32_t pronOrder = 0;
+    const char* first = text.data() + start;
+    if (*first == '+' && start + 1 < text.size())
+        ++first;
+    if (std::from_chars(first, text.data() + text.size(), pronOrder).ec != std::errc()) {
+        LOG(WARNING) << "dictionary_lookup_filter: ignoring pronOrder '" << text
+                     << "' of row '" << rawLine << "'.";
+        return 0;
+    }
+    return pronOrder;
+}
+
+// Splits a row with one scan for its delimiters, shared by all rows.
+ParsedRow ParseRow(std::string_view rawLine, vector<uint32_t>& delimiters) {
+    delimiters.clear();
+    FindDelimiters(rawLine, 8, delimiters);
+    ParsedRow row;
+    uint32_t commas[8];
+    size_t commaCount = 0;
+    for (const uint32_t pos : delimiters) {
+        if (rawLine[pos] == ',') {
+            if (commaCount == 8)
+                break;
+            commas[commaCount++] = pos;
+        } else if (commaCount == 5 || commaCount == 6) {
+            // columns 0-6 keep their positions in the stored line
+            row.pipes.push_back(pos);
+            ++row.pipeCounts[commaCount - 5];
+        }
+    }
+    auto column = [&](size_t i) {
+        const size_t start = i == 0 ? 0 : commas[i - 1] + 1;
+        const size_t end = i < commaCount ? commas[i] : rawLine.size();
+        return rawLine.substr(start, end - start);
+    };
+    row.columnCount = std::min<size_t>(commaCount + 1, 8);
+    row.pronOrder = row.columnCount > 7 ? ParsePronOrder(column(7), rawLine) : 0;
+    // columns 0-6, padded, followed by everything after the pronOrder column
+    for (size_t i = 0; i < 7; ++i) {
+        if (i > 0)
+            row.line += ',';
+        if (i < row.columnCount) {
+            const std::string_view text = column(i);
+            row.line.append(text.data(), text.size());
+        }
+        row.columnEnds[i] = row.line.size();
+    }
+    if (commaCount == 8) {
+        row.line += ',';
+        row.line.append(rawLine.data() + commas[7] + 1, rawLine.size() - commas[7] - 1);
+    }
+    return row;
+}
+
+const char kIndexMagic[8] = {'D', 'L', 'I', 'N', 'D', 'X', '0', '2'};
+
+// Native byte order, like the comment table.
+struct IndexFileHeader {
+    char magic[8];
+    uint32_t byteOrder;
+    uint32_t rowSize;
+    uint64_t sourceVersion;
+    uint64_t fingerprint;
+    uint64_t textSize;
+    uint64_t entryCount;
+    uint64_t rowCount;
+    uint64_t bucketCount;
+    uint64_t bucketRowCount;
+    uint64_t pipeCount;
+};
+
+template <class T>
+void WriteArray(std::ofstream& out, const vector<T>& items) {
+    out.write(reinterpret_cast<const char*>(items.data()), items.size() * sizeof(T));
+}
+
+template <class T>
+bool ReadArray(std::string_view& data, uint64_t count, vector<T>* items) {
+    if (count > data.size() / sizeof(T))
+        return false;
+    items->resize(count);
+    std::memcpy(items->data(), data.data(), count * sizeof(T));
+    data.remove_prefix(count * sizeof(T));
+    return true;
+}
+
+}  // namespace
+
+void LookupIndex::Add(const string& honzi, const string& line) {
+    if (!line.empty())
+        pending_[honzi].push_back(line);
+}
+
+void LookupIndex::Finish() {
+    vector<uint32_t> delimiters;
+    for (const auto& pending : pending_) {
+        vector<ParsedRow> parsedRows;
+        for (const string& line : pending.second)
+            parsedRows.push_back(ParseRow(line, delimiters));
+        // same order as inserting into a multimap keyed by pronOrder
+        std::stable_sort(parsedRows.begin(), parsedRows.end(),
+                         [](const ParsedRow& a, const ParsedRow& b) {
+                             return a.pronOrder < b.pronOrder;
+                         });
+
+        LookupEntry entry;
+        entry.honzi = {AppendText(pending.first), (uint32_t)pending.first.size()};
+        entry.firstRow = rows_.size();
+        entry.rowCount = parsedRows.size();
+        entry.firstBucket = buckets_.size();
+        vector<vector<uint32_t>> bucketRows;
+        for (const ParsedRow& parsedRow : parsedRows) {
+            LookupRow row;
+            row.line = {AppendText(parsedRow.line), (uint32_t)parsedRow.line.size()};
+            std::copy(parsedRow.columnEnds, parsedRow.columnEnds + 7, row.columnEnds);
+            row.columnCount = parsedRow.columnCount;
+            row.pronOrder = parsedRow.pronOrder;
+            row.firstPipe = pipes_.size();
+            row.pipeCounts[0] = parsedRow.pipeCounts[0];
+            row.pipeCounts[1] = parsedRow.pipeCounts[1];
+            pipes_.insert(pipes_.end(), parsedRow.pipes.begin(), parsedRow.pipes.end());
+            row.entry = entries_.size();
+            const TextRange pronunciation = {row.line.offset, row.columnEnds[0]};
+            row.bucket = entry.firstBucket;
+            while (row.bucket < buckets_.size() &&
+                   Text(buckets_[row.bucket].pronunciation) != Text(pronunciation))
+                ++row.bucket;
+            if (row.bucket == buckets_.size()) {
+                buckets_.push_back({pronunciation, 0, 0});
+                bucketRows.emplace_back();
+            }
+            bucketRows[row.bucket - entry.firstBucket].push_back(rows_.size());
+            rows_.push_back(row);
+        }
+        entry.bucketCount = buckets_.size() - entry.firstBucket;
+        for (size_t i = 0; i < bucketRows.size(); ++i) {
+            PronunciationBucket& bucket = buckets_[entry.firstBucket + i];
+            bucket.firstRow = bucketRows_.size();
+            bucket.rowCount = bucketRows[i].size();
+            bucketRows_.insert(bucketRows_.end(), bucketRows[i].begin(),
+                               bucketRows[i].end());
+        }
+        entries_.push_back(entry);
+    }
+    pending_.clear();
+
+    hash_map<string, uint32_t> dedupeIds;
+    for (uint32_t i = 0; i < rows_.size(); ++i)
+        rows_[i].dedupeId = dedupeIds.emplace(DedupeKey(rows_[i]), i).first->second;
+
+    // every honzi and row, in index order
+    fingerprint_ = HashText("");
+    for (const LookupRow& row : rows_) {
+        fingerprint_ = HashText(LookupHonzi(row), fingerprint_);
+        fingerprint_ = HashText("\t", fingerprint_);
+        fingerprint_ = HashText(Text(row.line), fingerprint_);
+        fingerprint_ = HashText("\n", fingerprint_);
+    }
+}
+
+bool LookupIndex::Load(Dictionary* dictionary) {
+    if (!dictionary || !dictionary->loaded() || dictionary->tables().empty())
+        return false;
+    // every honzi key of the lookup dictionary is one syllable
+    Syllabary syllabary;
+    if (!dictionary->primary_table()->GetSyllabary(&syllabary))
+        return false;
+    for (const string& honzi : syllabary) {
+        DictEntryIterator it;
+        dictionary->LookupWords(&it, honzi, false);
+        for (; !it.exhausted(); it.Next())
+            Add(honzi, it.Peek()->text);
+    }
+    Finish();
+    return true;
+}
+
+bool LookupIndex::LoadDictYaml(const string& path) {
+    std::ifstream in(path);
+    if (!in)
+        return false;
+    string line;
+    bool body = false;
+    while (std::getline(in, line)) {
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+        // rows follow the "..." line ending the yaml header
+        if (!body) {
+            body = line == "...";
+            continue;
+        }
+        const size_t tab = line.find('\t');
+        if (line.empty() || line[0] == '#' || tab == string::npos)
+            continue;
+        const size_t codeEnd = line.find('\t', tab + 1);
+        Add(line.substr(tab + 1, codeEnd == string::npos ? string::npos : codeEnd - tab - 1),
+            line.substr(0, tab));
+    }
+    if (!body)
+        return false;
+    Finish();
+    return true;
+}
+
+bool LookupIndex::Save(const string& path, uint64_t sourceVersion) const {
+    IndexFileHeader header = {};
+    std::memcpy(header.magic, kIndexMagic, sizeof(kIndexMagic));
+    header.byteOrder = 0x01020304;
+    header.rowSize = sizeof(LookupRow);
+    header.sourceVersion = sourceVersion;
+    header.fingerprint = fingerprint_;
+    header.textSize = text_.size();
+    header.entryCount = entries_.size();
+    header.rowCount = rows_.size();
+    header.bucketCount = buckets_.size();
+    header.bucketRowCount = bucketRows_.size();
+    header.pipeCount = pipes_.size();
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(text_.data(), text_.size());
+    WriteArray(out, entries_);
+    WriteArray(out, rows_);
+    WriteArray(out, buckets_);
+    WriteArray(out, bucketRows_);
+    WriteArray(out, pipes_);
+    return bool(out);
+}
+
+bool LookupIndex::Open(const string& path, uint64_t sourceVersion) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+        return false;
+    const string file((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    std::string_view data(file);
+    if (data.size() < sizeof(IndexFileHeader))
+        return false;
+    IndexFileHeader header;
+    std::memcpy(&header, data.data(), sizeof(header));
+    data.remove_prefix(sizeof(header));
+    if (std::memcmp(header.magic, kIndexMagic, sizeof(kIndexMagic)) != 0 ||
+        header.byteOrder != 0x01020304 || header.rowSize != sizeof(LookupRow) ||
+        header.sourceVersion != sourceVersion || header.textSize > data.size())
+        return false;
+    text_.assign(data.data(), header.textSize);
+    data.remove_prefix(header.textSize);
+    if (!ReadArray(data, header.entryCount, &entries_) ||
+        !ReadArray(data, header.rowCount, &rows_) ||
+        !ReadArray(data, header.bucketCount, &buckets_) ||
+        !ReadArray(data, header.bucketRowCount, &bucketRows_) ||
+        !ReadArray(data, header.pipeCount, &pipes_) || !data.empty() ||
+        !RangesValid()) {
+        text_.clear();
+        entries_.clear();
+        rows_.clear();
+        buckets_.clear();
+        bucketRows_.clear();
+        pipes_.clear();
+        return false;
+    }
+    fingerprint_ = header.fingerprint;
+    return true;
+}
+
+bool LookupIndex::RangesValid() const {
+    auto inText = [this](const TextRange& range) {
+        return range.offset <= text_.size() && range.length <= text_.size() - range.offset;
+    };
+    for (const LookupEntry& entry : entries_) {
+        if (!inText(entry.honzi) || entry.firstRow > rows_.size() ||
+            entry.rowCount > rows_.size() - entry.firstRow ||
+            entry.firstBucket > buckets_.size() ||
+            entry.bucketCount > buckets_.size() - entry.firstBucket)
+            return false;
+    }
+    for (const LookupRow& row : rows_) {
+        if (!inText(row.line) || row.entry >= entries_.size() ||
+            row.bucket >= buckets_.size() || row.dedupeId >= rows_.size() ||
+            row.columnEnds[6] > row.line.length || row.firstPipe > pipes_.size() ||
+            uint64_t(row.pipeCounts[0]) + row.pipeCounts[1] > pipes_.size() - row.firstPipe)
+            return false;
+        // every '|' lies within its column, in order
+        const uint32_t* pipe = pipes_.data() + row.firstPipe;
+        for (size_t column = 5; column <= 6; ++column) {
+            uint32_t start = row.columnEnds[column - 1];
+            for (size_t i = 0; i < row.pipeCounts[column - 5]; ++i, ++pipe) {
+                if (*pipe <= start || *pipe >= row.columnEnds[column])
+                    return false;
+                start = *pipe;
+            }
+        }
+    }
+    for (const PronunciationBucket& bucket : buckets_) {
+        if (!inText(bucket.pronunciation) || bucket.firstRow > bucketRows_.size() ||
+            bucket.rowCount > bucketRows_.size() - bucket.firstRow)
+            return false;
+    }
+    for (const uint32_t row : bucketRows_) {
+        if (row >= rows_.size())
+            return false;
+    }
+    return true;
+}
+
+const LookupEntry* LookupIndex::Find(std::string_view honzi) const {
+    const auto found = std::lower_bound(
+        entries_.begin(), entries_.end(), honzi,
+        [this](const LookupEntry& entry, std::string_view honzi) {
+            return Text(entry.honzi) < honzi;
+        });
+    if (found == entries_.end() || Text(found->honzi) != honzi)
+        return nullptr;
+    return &*found;
+}
+
+void LookupIndex::Split(const LookupEntry& entry,
+                        const ArenaVector<std::string_view>& pronunciations,
+                        ArenaVector<const LookupRow*>& matched,
+                        ArenaVector<const LookupRow*>& remaining) const {
+    ArenaVector<uint32_t> matchedBuckets(matched.get_allocator());
+    for (uint32_t i = entry.firstBucket; i < entry.firstBucket + entry.bucketCount; ++i) {
+        const std::string_view pronunciation = Text(buckets_[i].pronunciation);
+        for (const std::string_view candidate : pronunciations) {
+            if (candidate == pronunciation) {
+                matchedBuckets.push_back(i);
+                break;
+            }
+        }
+    }
+    if (matchedBuckets.size() == 1) {
+        const PronunciationBucket& bucket = buckets_[matchedBuckets[0]];
+        for (uint32_t i = bucket.firstRow; i < bucket.firstRow + bucket.rowCount; ++i)
+            matched.push_back(&rows_[bucketRows_[i]]);
+    }
+    for (uint32_t i = entry.firstRow; i < entry.firstRow + entry.rowCount; ++i) {
+        const LookupRow& row = rows_[i];
+        const bool match = std::find(matchedBuckets.begin(), matchedBuckets.end(),
+                                     row.bucket) != matchedBuckets.end();
+        if (!match)
+            remaining.push_back(&row);
+        else if (matchedBuckets.size() > 1)
+            matched.push_back(&row);
+    }
+}
+
+std::string_view LookupIndex::Column(const LookupRow& row, const size_t column) const {
+    const uint32_t start = column == 0 ? 0 : row.columnEnds[column - 1] + 1;
+    return Text({row.line.offset + start, row.columnEnds[column] - start});
+}
+
+size_t LookupIndex::FieldCount(const LookupRow& row, const size_t column) const {
+    return row.pipeCounts[column - 5] + 1;
+}
+
+std::string_view LookupIndex::Field(const LookupRow& row,
+                                    const size_t column,
+                                    const size_t i) const {
+    const uint32_t* pipes = pipes_.data() + row.firstPipe +
+                            (column == 6 ? row.pipeCounts[0] : 0);
+    const uint32_t start = i == 0 ? row.columnEnds[column - 1] + 1 : pipes[i - 1] + 1;
+    const uint32_t end = i == row.pipeCounts[column - 5] ? row.columnEnds[column] : pipes[i];
+    return Text({row.line.offset + start, end - start});
+}
+
+std::string_view LookupIndex::DisplayHonzi(const LookupRow& row) const {
+    const std::string_view honzi = Column(row, 1);
+    return honzi.empty() ? LookupHonzi(row) : honzi;
+}
+
+std::string_view LookupIndex::DisplayJyutping(const LookupRow& row) const {
+    const std::string_view jyutping = Column(row, 2);
+    return jyutping.empty() ? Column(row, 0) : jyutping;
+}
+
+std::string_view LookupIndex::Tail(const LookupRow& row) const {
+    const uint32_t start = row.columnEnds[2] + 1;
+    return Text({row.line.offset + start, row.line.length - start});
+}
+
+string LookupIndex::DedupeKey(const LookupRow& row) const {
+    string key(DisplayHonzi(row));
+    key += ',';
+    key += DisplayJyutping(row);
+    key += ',';
+    key += Tail(row);
+    return key;
+}
+
+size_t LookupIndex::CommentLineLength(const LookupRow& row, std::string_view tail) const {
+    return 5 + DisplayHonzi(row).size() + DisplayJyutping(row).size() + tail.size();
+}
+
+void LookupIndex::AppendCommentLine(string& output,
+                                    const LookupRow& row,
+                                    const char matchInputBuffer,
+                                    std::string_view tail) const {
+    output += '\r';
+    output += matchInputBuffer;
+    output += ',';
+    output += DisplayHonzi(row);
+    output += ',';
+    output += DisplayJyutping(row);
+    output += ',';
+    output += tail;
+}
+
+void LookupIndex::AppendFingerprintTag(string& output) const {
+    char tag[24];
+    const int length = std::snprintf(tag, sizeof(tag), "\r@%016llx",
+                                     static_cast<unsigned long long>(fingerprint_));
+    output.append(tag, length);
+}
+
+void LookupIndex::AppendRowReference(string& output,
+                                     const LookupRow& row,
+                                     const char matchInputBuffer) const {
+    char id[16];
+    const int length = std::snprintf(id, sizeof(id), "%u", unsigned(RowId(row)));
+    output += '\r';
+    output += matchInputBuffer;
+    output += '#';
+    output.append(id, length);
+}
+
+bool LookupIndex::ResolveRowReferences(std::string_view comment, string* resolved) const {
+    resolved->clear();
+    resolved->reserve(comment.size());
+    bool tagged = false;
+    size_t start = 0;
+    while (start < comment.size()) {
+        const size_t end = std::min(comment.find('\r', start + 1), comment.size());
+        const std::string_view line = comment.substr(start, end - start);
+        start = end;
+        if (line.size() > 2 && line[0] == '\r' && line[1] == '@') {
+            uint64_t fingerprint = 0;
+            const char* last = line.data() + line.size();
+            const auto parsed = std::from_chars(line.data() + 2, last, fingerprint, 16);
+            tagged = parsed.ec == std::errc() && parsed.ptr == last &&
+                     fingerprint == fingerprint_;
+            continue;
+        }
+        size_t id = 0;
+        bool isReference = line.size() > 3 && line[0] == '\r' && line[2] == '#';
+        for (size_t i = 3; isReference && i < line.size(); ++i) {
+            isReference = line[i] >= '0' && line[i] <= '9';
+            // saturates past the last row
+            id = std::min(id * 10 + (line[i] - '0'), rows_.size());
+        }
+        if (isReference && (!tagged || id >= rows_.size()))
+            return false;
+        if (isReference)
+            AppendCommentLine(*resolved, rows_[id], line[1]);
+        else
+            resolved->append(line.data(), line.size());
+    }
+    return true;
+}
+
+uint32_t LookupIndex::AppendText(std::string_view text) {
+    const uint32_t offset = text_.size();
+    text_.append(text.data(), text.size());
+    return offset;
+}
+
+uint64_t HashText(std::string_view text, uint64_t hash) {
+    for (const char c : text) {
+        hash ^= static_cast<unsigned char>(c);
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+}  // namespace rime
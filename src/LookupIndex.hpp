@@ -0,0 +1,157 @@
+//
+//  LookupIndex.hpp
+//  rime-dictionary-lookup-filter-objs
+//
+
+#ifndef LookupIndex_hpp
+#define LookupIndex_hpp
+
+#include <rime/common.h>
+#include <cstdint>
+#include <string_view>
+#include "LookupArena.hpp"
+
+namespace rime {
+
+class Dictionary;
+
+struct TextRange {
+    uint32_t offset = 0;
+    uint32_t length = 0;
+};
+
+// One dictionary row, parsed once at load time.
+// The stored line is the raw row without its pronOrder column, with the
+// leading columns 0-6 padded, so that columns 3-6 and everything after the
+// pronOrder column form a contiguous tail.
+struct LookupRow {
+    TextRange line;
+    // end of each leading column, relative to line.offset
+    uint32_t columnEnds[7];
+    // number of leading columns in the raw row, at most 8
+    uint32_t columnCount;
+    int32_t pronOrder;
+    uint32_t entry;
+    uint32_t bucket;
+    // rows with equal dedupe keys share the id of the first such row
+    uint32_t dedupeId;
+    // '|' delimiters of the component columns 5 and 6, found at load time
+    uint32_t firstPipe;  // into pipes_
+    uint32_t pipeCounts[2];
+};
+
+// Rows sharing one pronunciation (column 0) under one honzi.
+struct PronunciationBucket {
+    TextRange pronunciation;
+    uint32_t firstRow;  // into bucketRows_
+    uint32_t rowCount;
+};
+
+struct LookupEntry {
+    TextRange honzi;
+    uint32_t firstRow;  // rows of one honzi are contiguous and in pronOrder
+    uint32_t rowCount;
+    uint32_t firstBucket;
+    uint32_t bucketCount;
+};
+
+// Read-only in-memory index of a lookup dictionary: rows grouped by honzi,
+// presorted by pronOrder and bucketed by pronunciation.
+class LookupIndex {
+  public:
+    // Rows are collected with Add() and laid out by Finish().
+    void Add(const string& honzi, const string& line);
+    void Finish();
+    // Indexes every row of a loaded dictionary.
+    bool Load(Dictionary* dictionary);
+    // Indexes the rows of a *.dict.yaml file directly, without compiling
+    // it: each row is the text column, keyed by the code column.
+    bool LoadDictYaml(const string& path);
+    // Compiled lookup-only index: the laid out index, tagged with the
+    // version of the source it was built from.
+    bool Save(const string& path, uint64_t sourceVersion) const;
+    bool Open(const string& path, uint64_t sourceVersion);
+
+    const LookupEntry* Find(std::string_view honzi) const;
+    // Splits the rows of an entry into rows whose pronunciation is one of
+    // the given ones and the remaining rows, both in pronOrder order.
+    void Split(const LookupEntry& entry,
+               const ArenaVector<std::string_view>& pronunciations,
+               ArenaVector<const LookupRow*>& matched,
+               ArenaVector<const LookupRow*>& remaining) const;
+
+    std::string_view Text(const TextRange& range) const {
+        return std::string_view(text_.data() + range.offset, range.length);
+    }
+    std::string_view Column(const LookupRow& row, const size_t column) const;
+    // '|'-separated fields of component column 5 or 6, empty fields included
+    size_t FieldCount(const LookupRow& row, const size_t column) const;
+    std::string_view Field(const LookupRow& row, const size_t column, const size_t i) const;
+    std::string_view LookupHonzi(const LookupRow& row) const {
+        return Text(entries_[row.entry].honzi);
+    }
+    std::string_view DisplayHonzi(const LookupRow& row) const;
+    std::string_view DisplayJyutping(const LookupRow& row) const;
+    // columns 3-6 and everything after the pronOrder column
+    std::string_view Tail(const LookupRow& row) const;
+    // displayHonzi,displayJyutping,tail; ignores match_input_buffer and pronOrder
+    string DedupeKey(const LookupRow& row) const;
+
+    // Comment lines: "\r<match_input_buffer>,displayHonzi,displayJyutping,tail",
+    // or compact references "\r<match_input_buffer>#<row id>" to be resolved
+    // against the same index, after a "\r@<fingerprint>" line naming it.
+    // A projected tail may replace the row's own.
+    size_t CommentLineLength(const LookupRow& row) const {
+        return CommentLineLength(row, Tail(row));
+    }
+    size_t CommentLineLength(const LookupRow& row, std::string_view tail) const;
+    void AppendCommentLine(string& output,
+                           const LookupRow& row,
+                           const char matchInputBuffer) const {
+        AppendCommentLine(output, row, matchInputBuffer, Tail(row));
+    }
+    void AppendCommentLine(string& output,
+                           const LookupRow& row,
+                           const char matchInputBuffer,
+                           std::string_view tail) const;
+    void AppendFingerprintTag(string& output) const;
+    void AppendRowReference(string& output,
+                            const LookupRow& row,
+                            const char matchInputBuffer) const;
+    // Replaces the row references in a comment with full comment lines and
+    // drops the fingerprint tags; everything else is copied as is. Fails if
+    // a reference is not tagged with the fingerprint of this index, e.g.
+    // when it was emitted before the dictionary was reloaded.
+    bool ResolveRowReferences(std::string_view comment, string* resolved) const;
+
+    uint32_t RowId(const LookupRow& row) const { return &row - rows_.data(); }
+
+    size_t entry_count() const { return entries_.size(); }
+    size_t row_count() const { return rows_.size(); }
+    const LookupEntry& entry_at(size_t i) const { return entries_[i]; }
+    const LookupRow& row_at(size_t i) const { return rows_[i]; }
+    const PronunciationBucket& bucket_at(size_t i) const { return buckets_[i]; }
+    // identifies the indexed rows, so that precompiled data can be checked
+    // against them
+    uint64_t fingerprint() const { return fingerprint_; }
+
+  private:
+    uint32_t AppendText(std::string_view text);
+    // checks an opened index before it is used
+    bool RangesValid() const;
+
+    string text_;
+    vector<LookupEntry> entries_;
+    vector<LookupRow> rows_;
+    vector<PronunciationBucket> buckets_;
+    vector<uint32_t> bucketRows_;
+    vector<uint32_t> pipes_;
+    map<string, vector<string>> pending_;
+    uint64_t fingerprint_ = 0;
+};
+
+// 64-bit FNV-1a; stable across platforms and runs.
+uint64_t HashText(std::string_view text, uint64_t hash = 14695981039346656037ull);
+};  // namespace rime
+
+#endif /* LookupIndex_hpp */
@@ -0,0 +1,465 @@
+//
+//  LookupIndexRegistry.cpp
+//  rime-dictionary-lookup-filter-objs
+//
+
+#include "LookupIndexRegistry.hpp"
+
+#include <rime/deployer.h>
+#include <rime/resource.h>
+#include <rime/service.h>
+#include <rime/dict/dictionary.h>
+#include <boost/range/algorithm_ext/erase.hpp>
+#include <algorithm>
+#include <chrono>
+#include <exception>
+#include <thread>
+
+namespace rime {
+
+namespace {
+
+std::filesystem::path CompiledTablePath(const string& dictname) {
+    the<ResourceResolver> resolver(Service::instance().CreateDeployedResourceResolver(
+            {"compiled_table", "", ".table.bin"}));
+    return resolver->ResolvePath(dictname).string();
+}
+
+std::filesystem::path LookupOnlyIndexPath(const string& dictname) {
+    the<ResourceResolver> resolver(Service::instance().CreateDeployedResourceResolver(
+            {"lookup_index", "", ".lookup.bin"}));
+    return resolver->ResolvePath(dictname).string();
+}
+
+// the user's copy of the source wins over the shared one
+std::filesystem::path DictYamlPath(const string& dictname) {
+    the<ResourceResolver> resolver(Service::instance().CreateResourceResolver(
+            {"dict_source", "", ".dict.yaml"}));
+    std::filesystem::path path = resolver->ResolvePath(dictname).string();
+    std::error_code error;
+    if (!std::filesystem::exists(path, error)) {
+        resolver->set_root_path(Service::instance().deployer().shared_data_dir);
+        path = resolver->ResolvePath(dictname).string();
+    }
+    return path;
+}
+
+// changes with every edit of the source file
+uint64_t SourceVersion(const std::filesystem::path& path) {
+    std::error_code error;
+    const auto modified = std::filesystem::last_write_time(path, error);
+    if (error)
+        return 0;
+    const uint64_t size = std::filesystem::file_size(path, error);
+    return uint64_t(modified.time_since_epoch().count()) * 1099511628211ull ^ size;
+}
+
+// What indexing a dictionary needs from librime, gathered on the calling
+// thread: resolving paths and opening the compiled dictionary go through
+// shared components that are not synchronized with the engines using them.
+struct LookupSource {
+    string dictname;
+    bool lookupOnly = false;
+    std::chrono::steady_clock::time_point start;
+    // compiled dictionary, loaded
+    an<Dictionary> dictionary;
+    // lookup-only: the *.dict.yaml source and the compiled lookup index
+    std::filesystem::path source;
+    std::filesystem::path compiled;
+};
+
+LookupSource OpenLookupSource(const string& dictname, bool lookupOnly) {
+    LookupSource source;
+    source.dictname = dictname;
+    source.lookupOnly = lookupOnly;
+    source.start = std::chrono::steady_clock::now();
+    if (lookupOnly) {
+        source.source = DictYamlPath(dictname);
+        source.compiled = LookupOnlyIndexPath(dictname);
+        return source;
+    }
+    DictionaryComponent* dictionary = dynamic_cast<DictionaryComponent*>(
+            Dictionary::Require("dictionary"));
+    if (!dictionary)
+        return source;
+    an<Dictionary> dict(dictionary->Create(dictname, dictname, {}));
+    if (dict && dict->Load())
+        source.dictionary = dict;
+    return source;
+}
+
+an<LookupIndex> IndexLookupOnlySource(const LookupSource& source) {
+    const uint64_t version = SourceVersion(source.source);
+    if (version == 0) {
+        LOG(ERROR) << "dictionary_lookup_filter: missing '" << source.source.string() << "'.";
+        return nullptr;
+    }
+    auto index = New<LookupIndex>();
+    const bool upToDate = index->Open(source.compiled.string(), version);
+    if (!upToDate) {
+        index = New<LookupIndex>();
+        if (!index->LoadDictYaml(source.source.string())) {
+            LOG(ERROR) << "dictionary_lookup_filter: failed to index '"
+                       << source.source.string() << "'.";
+            return nullptr;
+        }
+        std::error_code error;
+        std::filesystem::create_directories(source.compiled.parent_path(), error);
+        if (!index->Save(source.compiled.string(), version))
+            LOG(WARNING) << "dictionary_lookup_filter: cannot write '"
+                         << source.compiled.string() << "'.";
+    }
+    const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - source.start);
+    LOG(INFO) << "dictionary_lookup_filter: " << (upToDate ? "opened " : "indexed ")
+              << index->row_count() << " rows of " << index->entry_count()
+              << " entries from '" << source.dictname << "' in " << elapsed.count() << " ms.";
+    return index;
+}
+
+// Uses no librime component, so it may run on any thread; the opened
+// dictionary only reads its mapped files.
+an<LookupIndex> IndexLookupSource(const LookupSource& source) {
+    if (source.lookupOnly)
+        return IndexLookupOnlySource(source);
+    // rows are parsed once into the index; the dictionary itself is
+    // only needed while building it
+    if (!source.dictionary)
+        return nullptr;
+    auto index = New<LookupIndex>();
+    if (!index->Load(source.dictionary.get())) {
+        LOG(ERROR) << "dictionary_lookup_filter: failed to index '" << source.dictname << "'.";
+        return nullptr;
+    }
+    const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - source.start);
+    LOG(INFO) << "dictionary_lookup_filter: indexed " << index->row_count()
+              << " rows of " << index->entry_count() << " entries from '"
+              << source.dictname << "' in " << elapsed.count() << " ms.";
+    return index;
+}
+
+typedef LookupIndexRegistry::TailColumns TailColumns;
+typedef LookupIndexRegistry::SharedProjection SharedProjection;
+typedef LookupIndexRegistry::LoadedIndex LoadedIndex;
+typedef std::promise<LoadedIndex> IndexPromise;
+
+an<const LookupIndex> IndexOrNull(const LookupSource& source) {
+    try {
+        return IndexLookupSource(source);
+    } catch (const std::exception& e) {
+        LOG(ERROR) << "dictionary_lookup_filter: failed to index '" << source.dictname
+                   << "': " << e.what();
+        return nullptr;
+    }
+}
+
+SharedProjection Project(const LookupIndex& index, const TailColumns& columns) {
+    return {columns, New<TailProjection>(index, columns.first, columns.second)};
+}
+
+// the index with its projections, which take as long as indexing again
+LoadedIndex LoadOrNull(const LookupSource& source, const vector<TailColumns>& columns) {
+    LoadedIndex loaded;
+    loaded.index = IndexOrNull(source);
+    if (loaded.index) {
+        for (const TailColumns& list : columns)
+            loaded.projections.push_back(Project(*loaded.index, list));
+    }
+    return loaded;
+}
+
+const SharedProjection* FindProjection(const vector<SharedProjection>& projections,
+                                       const TailColumns& columns) {
+    for (const SharedProjection& projection : projections) {
+        if (projection.columns == columns)
+            return &projection;
+    }
+    return nullptr;
+}
+
+// Opens the dictionary on the calling thread and indexes it there or on a
+// detached thread, which shares nothing but the promise, so nobody has to
+// join it. The promise is always fulfilled, as others may be waiting on it.
+void StartLoad(const an<IndexPromise>& promise,
+               const string& dictname,
+               bool lookupOnly,
+               const vector<TailColumns>& columns,
+               bool background) {
+    LookupSource source;
+    try {
+        source = OpenLookupSource(dictname, lookupOnly);
+        if (background) {
+            std::thread([promise, source, columns] {
+                promise->set_value(LoadOrNull(source, columns));
+            }).detach();
+            return;
+        }
+    } catch (const std::exception& e) {
+        LOG(ERROR) << "dictionary_lookup_filter: failed to load '" << dictname
+                   << "': " << e.what();
+        promise->set_value(LoadedIndex());
+        return;
+    }
+    promise->set_value(LoadOrNull(source, columns));
+}
+
+// projects an index already held on a detached thread, like StartLoad()
+void StartProjection(const an<IndexPromise>& promise,
+                     const an<const LookupIndex>& index,
+                     const TailColumns& columns) {
+    std::thread([promise, index, columns] {
+        LoadedIndex loaded;
+        loaded.index = index;
+        loaded.projections.push_back(Project(*index, columns));
+        promise->set_value(loaded);
+    }).detach();
+}
+
+LookupIndexRegistry::PendingIndex ReadyIndex(an<const LookupIndex> index) {
+    IndexPromise promise;
+    promise.set_value({index, {}});
+    return promise.get_future().share();
+}
+
+}  // namespace
+
+LookupIndexRegistry& LookupIndexRegistry::instance() {
+    static LookupIndexRegistry registry;
+    return registry;
+}
+
+void LookupIndexRegistry::Prune() {
+    for (auto it = indices_.begin(); it != indices_.end();) {
+        Slot& slot = it->second;
+        Unpin(slot);
+        if (slot.index.expired())
+            slot.projections.clear();
+        if (slot.index.expired() && !slot.loading.valid() && !slot.reloading.valid())
+            it = indices_.erase(it);
+        else
+            ++it;
+    }
+}
+
+void LookupIndexRegistry::Unpin(Slot& slot) {
+    boost::remove_erase_if(slot.superseded, [](const weak<const LookupIndex>& index) {
+        return index.expired();
+    });
+    if (slot.superseded.empty())
+        slot.pinned.reset();
+}
+
+an<const LookupIndex> LookupIndexRegistry::Adopt(Slot& slot) {
+    an<const LookupIndex> index = slot.index.lock();
+    if (!slot.loading.valid() ||
+        slot.loading.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+        return index;
+    const LoadedIndex loaded = slot.loading.get();
+    slot.loading = PendingIndex();
+    if (!index) {
+        index = loaded.index;
+        slot.index = index;
+        slot.projections = loaded.projections;
+    } else if (loaded.index == index) {
+        for (const SharedProjection& projection : loaded.projections) {
+            if (!FindProjection(slot.projections, projection.columns))
+                slot.projections.push_back(projection);
+        }
+    }
+    return index;
+}
+
+bool LookupIndexRegistry::AddColumns(Slot& slot, const TailColumns& columns) {
+    if (columns.first.empty() && columns.second.empty())
+        return false;
+    if (std::find(slot.columns.begin(), slot.columns.end(), columns) != slot.columns.end())
+        return false;
+    slot.columns.push_back(columns);
+    return true;
+}
+
+// Loads run outside the lock: the slot holds the pending load, so that
+// others join it instead of loading again, and Refresh() is never held up.
+an<const LookupIndex> LookupIndexRegistry::Require(const string& dictname,
+                                                   bool lookupOnly,
+                                                   const TailColumns& columns) {
+    PendingIndex pending;
+    an<IndexPromise> promise;
+    vector<TailColumns> loadColumns;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        Prune();
+        Slot& slot = indices_[dictname];
+        AddColumns(slot, columns);
+        if (an<const LookupIndex> index = Adopt(slot))
+            return index;
+        if (!slot.loading.valid()) {
+            slot.lookupOnly = lookupOnly;
+            loadedLookupOnly_[dictname] = lookupOnly;
+            slot.stamp = SourceStamp(dictname, lookupOnly);
+            promise = New<IndexPromise>();
+            slot.loading = promise->get_future().share();
+            loadColumns = slot.columns;
+        }
+        pending = slot.loading;
+    }
+    if (promise)
+        StartLoad(promise, dictname, lookupOnly, loadColumns, false);
+    const LoadedIndex& loaded = pending.get();
+    std::lock_guard<std::mutex> lock(mutex_);
+    Slot& slot = indices_[dictname];
+    if (an<const LookupIndex> held = Adopt(slot))
+        return held;
+    // adopted and let go by others while this caller waited
+    if (loaded.index) {
+        slot.index = loaded.index;
+        slot.projections = loaded.projections;
+    }
+    return loaded.index;
+}
+
+an<const LookupIndex> LookupIndexRegistry::RequireAsLoaded(const string& dictname) {
+    bool lookupOnly = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        const auto loaded = loadedLookupOnly_.find(dictname);
+        if (loaded == loadedLookupOnly_.end())
+            return nullptr;
+        lookupOnly = loaded->second;
+    }
+    an<const LookupIndex> index = Require(dictname, lookupOnly);
+    std::lock_guard<std::mutex> lock(mutex_);
+    Slot& slot = indices_[dictname];
+    // a reload finished meanwhile is retained by Refresh()
+    if (index && slot.index.lock() == index)
+        slot.retained = index;
+    return index;
+}
+
+LookupIndexRegistry::PendingIndex LookupIndexRegistry::RequireAsync(const string& dictname,
+                                                                    bool lookupOnly,
+                                                                    const TailColumns& columns) {
+    PendingIndex pending;
+    an<IndexPromise> promise;
+    an<const LookupIndex> held;
+    vector<TailColumns> loadColumns;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        Prune();
+        Slot& slot = indices_[dictname];
+        AddColumns(slot, columns);
+        held = Adopt(slot);
+        const bool projected = (columns.first.empty() && columns.second.empty()) ||
+                               FindProjection(slot.projections, columns);
+        // a projection missing while another one is built is left to Projection()
+        if (held && (projected || slot.loading.valid()))
+            return ReadyIndex(held);
+        if (!slot.loading.valid()) {
+            if (!held) {
+                slot.lookupOnly = lookupOnly;
+                loadedLookupOnly_[dictname] = lookupOnly;
+                slot.stamp = SourceStamp(dictname, lookupOnly);
+                loadColumns = slot.columns;
+            }
+            promise = New<IndexPromise>();
+            slot.loading = promise->get_future().share();
+        }
+        pending = slot.loading;
+    }
+    if (held)
+        StartProjection(promise, held, columns);
+    else if (promise)
+        StartLoad(promise, dictname, lookupOnly, loadColumns, true);
+    return pending;
+}
+
+an<const LookupIndex> LookupIndexRegistry::Refresh(const string& dictname,
+                                                   const an<const LookupIndex>& current,
+                                                   bool checkSource) {
+    an<IndexPromise> promise;
+    bool lookupOnly = false;
+    vector<TailColumns> loadColumns;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        Slot& slot = indices_[dictname];
+        if (slot.reloading.valid() &&
+            slot.reloading.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+            // a failed reload keeps the old index until the files change again
+            const LoadedIndex loaded = slot.reloading.get();
+            const an<const LookupIndex>& index = loaded.index;
+            slot.reloading = PendingIndex();
+            if (index) {
+                LOG(INFO) << "dictionary_lookup_filter: reloaded '" << dictname << "'.";
+                // pinned until every holder of an older index has moved on,
+                // whichever sessions close first
+                if (!slot.index.expired())
+                    slot.superseded.push_back(slot.index);
+                slot.index = index;
+                slot.projections = loaded.projections;
+                slot.pinned = index;
+                if (slot.retained)
+                    slot.retained = index;
+                Unpin(slot);
+                return index;
+            }
+        }
+        Unpin(slot);
+        an<const LookupIndex> latest = slot.index.lock();
+        if (latest && latest != current)
+            return latest;
+        if (!checkSource || slot.reloading.valid())
+            return current;
+        lookupOnly = slot.lookupOnly;
+        const Stamp stamp = SourceStamp(dictname, lookupOnly);
+        if (stamp == slot.stamp)
+            return current;
+        slot.stamp = stamp;
+        promise = New<IndexPromise>();
+        slot.reloading = promise->get_future().share();
+        loadColumns = slot.columns;
+    }
+    StartLoad(promise, dictname, lookupOnly, loadColumns, true);
+    return current;
+}
+
+an<const TailProjection> LookupIndexRegistry::Projection(const string& dictname,
+                                                         const an<const LookupIndex>& index,
+                                                         const TailColumns& columns) {
+    if (!index || (columns.first.empty() && columns.second.empty()))
+        return nullptr;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        Slot& slot = indices_[dictname];
+        Adopt(slot);
+        if (slot.index.lock() == index) {
+            if (const SharedProjection* shared = FindProjection(slot.projections, columns))
+                return shared->projection;
+        }
+    }
+    SharedProjection built = Project(*index, columns);
+    std::lock_guard<std::mutex> lock(mutex_);
+    Slot& slot = indices_[dictname];
+    AddColumns(slot, columns);
+    // an older index is no longer shared, and its projection is not kept
+    if (slot.index.lock() != index)
+        return built.projection;
+    if (const SharedProjection* shared = FindProjection(slot.projections, columns))
+        return shared->projection;
+    slot.projections.push_back(built);
+    return built.projection;
+}
+
+LookupIndexRegistry::Stamp LookupIndexRegistry::SourceStamp(const string& dictname,
+                                                            bool lookupOnly) {
+    std::error_code error;
+    const Stamp stamp = std::filesystem::last_write_time(
+            lookupOnly ? DictYamlPath(dictname) : CompiledTablePath(dictname), error);
+    return error ? Stamp() : stamp;
+}
+
+an<LookupIndex> LoadLookupIndex(const string& dictname, bool lookupOnly) {
+    return IndexLookupSource(OpenLookupSource(dictname, lookupOnly));
+}
+
+}  // namespace rime
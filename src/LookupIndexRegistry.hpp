@@ -0,0 +1,133 @@
+//
+//  LookupIndexRegistry.hpp
+//  rime-dictionary-lookup-filter-objs
+//
+
+#ifndef LookupIndexRegistry_hpp
+#define LookupIndexRegistry_hpp
+
+#include <rime/common.h>
+#include <filesystem>
+#include <future>
+#include <mutex>
+#include "LookupIndex.hpp"
+#include "TailProjection.hpp"
+
+namespace rime {
+
+// Process-wide registry of loaded lookup dictionaries, keyed by dictionary
+// name. Filters of every engine and session share one read-only index,
+// which is released when the last filter using it goes away.
+class LookupIndexRegistry {
+  public:
+    // matched_columns and unmatched_columns of a TailProjection
+    typedef pair<vector<int>, vector<int>> TailColumns;
+
+    struct SharedProjection {
+        TailColumns columns;
+        an<const TailProjection> projection;
+    };
+
+    struct LoadedIndex {
+        an<const LookupIndex> index;
+        // projections built next to the index, for the column lists asked
+        // for when the load started
+        vector<SharedProjection> projections;
+    };
+
+    // Fulfilled once a background load finishes; holders may drop it
+    // without waiting for the load.
+    typedef std::shared_future<LoadedIndex> PendingIndex;
+
+    static LookupIndexRegistry& instance();
+
+    // Returns the shared index of a dictionary, loading it if no filter
+    // holds it yet, or waiting for the load already under way. Returns
+    // nullptr if the dictionary cannot be loaded. lookupOnly loads it as
+    // LoadLookupIndex() does; an index already held is shared whichever way
+    // it was loaded. The registry is not locked during the load. Non-empty
+    // columns are projected next to every later load of the dictionary,
+    // and next to this one if it starts it; see Projection().
+    an<const LookupIndex> Require(const string& dictname,
+                                  bool lookupOnly = false,
+                                  const TailColumns& columns = TailColumns());
+    // Like Require(), but never waits: a dictionary not held yet is indexed
+    // on a detached thread, and once it is ready Require() hands out the
+    // same index. Only opening the dictionary, which goes through librime's
+    // unsynchronized dictionary component, runs on the calling thread. The
+    // projection of columns is built on that thread too, also for an index
+    // already held.
+    PendingIndex RequireAsync(const string& dictname,
+                              bool lookupOnly = false,
+                              const TailColumns& columns = TailColumns());
+    // Require() for the module API, which does not know how the filters
+    // load a dictionary: loads it the way its last index was loaded, so
+    // that row ids resolve against the same rows. The index is then kept
+    // for later calls, also once no filter holds it, until the dictionary
+    // is reloaded. Returns nullptr if no filter has loaded it.
+    an<const LookupIndex> RequireAsLoaded(const string& dictname);
+    // Returns the newest index of a dictionary. With checkSource set, a
+    // change of the compiled dictionary starts reloading it in the
+    // background; until that finishes, current is returned. Never waits for
+    // a load, and holders of the old index keep it until they let go.
+    an<const LookupIndex> Refresh(const string& dictname,
+                                  const an<const LookupIndex>& current,
+                                  bool checkSource);
+    // The projection of the latest index of a dictionary shared by every
+    // filter with the same columns. Built next to the index for the columns
+    // passed to Require() or RequireAsync() before its load started;
+    // otherwise it is built here, without locking the registry, once per
+    // index. index must be held by the caller as long as the projection.
+    an<const TailProjection> Projection(const string& dictname,
+                                        const an<const LookupIndex>& index,
+                                        const TailColumns& columns);
+
+  private:
+    typedef std::filesystem::file_time_type Stamp;
+
+    struct Slot {
+        weak<const LookupIndex> index;
+        bool lookupOnly = false;
+        // modification time of the file the index was loaded from
+        Stamp stamp;
+        // first load, or projection of the index held, and reload under
+        // way; a finished first load is kept until a filter adopts it
+        PendingIndex loading;
+        PendingIndex reloading;
+        // held for the module API, so that it does not reindex per call
+        an<const LookupIndex> retained;
+        // a reloaded index is held here while filters still hold one it
+        // replaced, so that it survives until they refresh
+        an<const LookupIndex> pinned;
+        vector<weak<const LookupIndex>> superseded;
+        // column lists asked for, projected next to each load, and their
+        // projections of index; they refer to index without holding it
+        vector<TailColumns> columns;
+        vector<SharedProjection> projections;
+    };
+
+    LookupIndexRegistry() = default;
+    // drops the slots of dictionaries nobody holds or loads
+    void Prune();
+    // the index held, or the finished first load, now held; takes over the
+    // projections built with either
+    an<const LookupIndex> Adopt(Slot& slot);
+    // records columns for later loads; false if they are empty or known
+    static bool AddColumns(Slot& slot, const TailColumns& columns);
+    // lets go of a reloaded index once no older one is held
+    void Unpin(Slot& slot);
+    static Stamp SourceStamp(const string& dictname, bool lookupOnly);
+
+    std::mutex mutex_;
+    hash_map<string, Slot> indices_;
+    // lookupOnly of the last load of each dictionary; outlives its slot
+    hash_map<string, bool> loadedLookupOnly_;
+};
+
+// Indexes a compiled dictionary, or with lookupOnly its *.dict.yaml
+// source, through a compiled lookup-only index kept in the staging
+// directory. The lookup-only path loads neither prism nor spelling algebra.
+an<LookupIndex> LoadLookupIndex(const string& dictname, bool lookupOnly = false);
+};  // namespace rime
+
+#endif /* LookupIndexRegistry_hpp */
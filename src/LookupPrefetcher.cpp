@@ -0,0 +1,81 @@
+//
+//  LookupPrefetcher.cpp
+//  rime-dictionary-lookup-filter-objs
+//
+
+#include "LookupPrefetcher.hpp"
+
+namespace rime {
+
+LookupPrefetcher::LookupPrefetcher(the<LookupExpander> expander)
+        : expander_(std::move(expander)), thread_(&LookupPrefetcher::Work, this) {}
+
+LookupPrefetcher::~LookupPrefetcher() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    wake_.notify_all();
+    thread_.join();
+}
+
+void LookupPrefetcher::Reset(const LookupIndex* index, const TailProjection* projection) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    ++generation_;
+    queue_.clear();
+    results_.clear();
+    idle_.wait(lock, [this] { return !busy_; });
+    expander_->Reset(index, projection);
+}
+
+void LookupPrefetcher::Prefetch(vector<LookupRequest> requests) {
+    if (requests.empty())
+        return;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (LookupRequest& request : requests)
+            queue_.push_back(std::move(request));
+    }
+    wake_.notify_one();
+}
+
+void LookupPrefetcher::Cancel() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++generation_;
+    queue_.clear();
+    results_.clear();
+}
+
+bool LookupPrefetcher::Take(const string& key, string* result) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const auto found = results_.find(key);
+    if (found == results_.end())
+        return false;
+    *result = std::move(found->second);
+    results_.erase(found);
+    return true;
+}
+
+void LookupPrefetcher::Work() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        wake_.wait(lock, [this] { return stopping_ || !queue_.empty(); });
+        if (stopping_)
+            return;
+        LookupRequest request = std::move(queue_.front());
+        queue_.pop_front();
+        if (results_.count(request.key))
+            continue;
+        const size_t generation = generation_;
+        busy_ = true;
+        lock.unlock();
+        string result = expander_->ParseEntry(request.honzi, request.jyutping, false);
+        lock.lock();
+        busy_ = false;
+        idle_.notify_all();
+        if (generation == generation_)
+            results_[request.key] = std::move(result);
+    }
+}
+
+}  // namespace rime
@@ -0,0 +1,59 @@
+//
+//  LookupPrefetcher.hpp
+//  rime-dictionary-lookup-filter-objs
+//
+
+#ifndef LookupPrefetcher_hpp
+#define LookupPrefetcher_hpp
+
+#include <rime/common.h>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include "LookupExpander.hpp"
+
+namespace rime {
+
+// A word lookup of one candidate, keyed by its result cache key.
+struct LookupRequest {
+    string key;
+    string honzi;
+    string jyutping;
+
+    bool operator<(const LookupRequest& other) const { return key < other.key; }
+    bool operator==(const LookupRequest& other) const { return key == other.key; }
+};
+
+// Runs speculative word lookups on a background thread with its own
+// expander. Finished results are handed out once with Take(); Cancel()
+// drops queued work, and work still running is discarded when it finishes.
+class LookupPrefetcher {
+  public:
+    explicit LookupPrefetcher(the<LookupExpander> expander);
+    ~LookupPrefetcher();
+
+    // Cancels everything and waits for running work before switching the
+    // index.
+    void Reset(const LookupIndex* index, const TailProjection* projection = nullptr);
+    void Prefetch(vector<LookupRequest> requests);
+    void Cancel();
+    bool Take(const string& key, string* result);
+
+  private:
+    void Work();
+
+    the<LookupExpander> expander_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable idle_;
+    std::deque<LookupRequest> queue_;
+    hash_map<string, string> results_;
+    size_t generation_ = 0;
+    bool busy_ = false;
+    bool stopping_ = false;
+    std::thread thread_;
+};
+};  // namespace rime
+
+#endif /* LookupPrefetcher_hpp */
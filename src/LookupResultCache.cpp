@@ -0,0 +1,56 @@
+//
+//  LookupResultCache.cpp
+//  rime-dictionary-lookup-filter-objs
+//
+
+#include "LookupResultCache.hpp"
+
+namespace rime {
+
+bool LookupResultCache::Find(const string& key, string* result) {
+    if (!enabled())
+        return false;
+    const auto found = index_.find(key);
+    if (found == index_.end()) {
+        ++misses_;
+        return false;
+    }
+    ++hits_;
+    // most recently used entries are kept at the front
+    entries_.splice(entries_.begin(), entries_, found->second);
+    *result = found->second->second;
+    return true;
+}
+
+void LookupResultCache::Insert(const string& key, const string& result) {
+    if (!enabled())
+        return;
+    const auto found = index_.find(key);
+    if (found != index_.end()) {
+        found->second->second = result;
+        entries_.splice(entries_.begin(), entries_, found->second);
+        return;
+    }
+    entries_.push_front({key, result});
+    index_[key] = entries_.begin();
+    Evict();
+}
+
+void LookupResultCache::Clear() {
+    entries_.clear();
+    index_.clear();
+}
+
+void LookupResultCache::set_capacity(size_t capacity) {
+    capacity_ = capacity;
+    Evict();
+}
+
+void LookupResultCache::Evict() {
+    while (entries_.size() > capacity_) {
+        index_.erase(entries_.back().first);
+        entries_.pop_back();
+    }
+}
+
+}  // namespace rime
@@ -0,0 +1,44 @@
+//
+//  LookupResultCache.hpp
+//  rime-dictionary-lookup-filter-objs
+//
+
+#ifndef LookupResultCache_hpp
+#define LookupResultCache_hpp
+
+#include <rime/common.h>
+
+namespace rime {
+
+// Size-bounded LRU cache of finished comment strings, keyed by the
+// normalized lookup key.
+class LookupResultCache {
+  public:
+    explicit LookupResultCache(size_t capacity = 0) : capacity_(capacity) {}
+
+    bool Find(const string& key, string* result);
+    // Like Find(), but neither counted nor refreshed.
+    bool Contains(const string& key) const { return index_.count(key) > 0; }
+    void Insert(const string& key, const string& result);
+    void Clear();
+
+    bool enabled() const { return capacity_ > 0; }
+    size_t capacity() const { return capacity_; }
+    void set_capacity(size_t capacity);
+    size_t hits() const { return hits_; }
+    size_t misses() const { return misses_; }
+
+  private:
+    typedef list<pair<string, string>> Entries;
+
+    void Evict();
+
+    size_t capacity_;
+    Entries entries_;
+    hash_map<string, Entries::iterator> index_;
+    size_t hits_ = 0;
+    size_t misses_ = 0;
+};
+};  // namespace rime
+
+#endif /* LookupResultCache_hpp */
@@ -0,0 +1,62 @@
+//
+//  LookupWorkerPool.cpp
+//  rime-dictionary-lookup-filter-objs
+//
+
+#include "LookupWorkerPool.hpp"
+
+namespace rime {
+
+LookupWorkerPool::LookupWorkerPool(size_t threads) {
+    for (size_t worker = 0; worker < threads; ++worker)
+        threads_.emplace_back(&LookupWorkerPool::Work, this, worker);
+}
+
+LookupWorkerPool::~LookupWorkerPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    wake_.notify_all();
+    for (std::thread& thread : threads_)
+        thread.join();
+}
+
+void LookupWorkerPool::Run(size_t count, const Task& task) {
+    if (count == 0)
+        return;
+    if (threads_.empty()) {
+        for (size_t i = 0; i < count; ++i)
+            task(0, i);
+        return;
+    }
+    std::unique_lock<std::mutex> lock(mutex_);
+    task_ = &task;
+    count_ = count;
+    next_ = 0;
+    pending_ = count;
+    wake_.notify_all();
+    done_.wait(lock, [this] { return pending_ == 0; });
+    task_ = nullptr;
+    count_ = 0;
+    next_ = 0;
+}
+
+void LookupWorkerPool::Work(size_t worker) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        wake_.wait(lock, [this] { return stopping_ || next_ < count_; });
+        if (stopping_)
+            return;
+        while (next_ < count_) {
+            const size_t task = next_++;
+            lock.unlock();
+            (*task_)(worker, task);
+            lock.lock();
+            if (--pending_ == 0)
+                done_.notify_all();
+        }
+    }
+}
+
+}  // namespace rime
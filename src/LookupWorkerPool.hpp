@@ -0,0 +1,45 @@
+//
+//  LookupWorkerPool.hpp
+//  rime-dictionary-lookup-filter-objs
+//
+
+#ifndef LookupWorkerPool_hpp
+#define LookupWorkerPool_hpp
+
+#include <rime/common.h>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+namespace rime {
+
+// A fixed set of worker threads running one batch of tasks at a time.
+// Tasks are told which worker runs them, so each worker can own state
+// such as a LookupExpander.
+class LookupWorkerPool {
+  public:
+    typedef function<void(size_t worker, size_t task)> Task;
+
+    explicit LookupWorkerPool(size_t threads);
+    ~LookupWorkerPool();
+
+    size_t size() const { return threads_.size(); }
+    // Runs task(worker, i) for every i in [0, count) and waits for all of them.
+    void Run(size_t count, const Task& task);
+
+  private:
+    void Work(size_t worker);
+
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable done_;
+    vector<std::thread> threads_;
+    const Task* task_ = nullptr;
+    size_t count_ = 0;
+    size_t next_ = 0;
+    size_t pending_ = 0;
+    bool stopping_ = false;
+};
+};  // namespace rime
+
+#endif /* LookupWorkerPool_hpp */
@@ -0,0 +1,166 @@
+//
+//  RowTokenizer.cpp
+//  rime-dictionary-lookup-filter-objs
+//
+
+#include "RowTokenizer.hpp"
+
+#if defined(__x86_64__) || defined(_M_X64) || (defined(__i386__) && defined(__SSE2__))
+#define ROW_TOKENIZER_SSE2 1
+#include <emmintrin.h>
+#endif
+// the AVX2 path is compiled for its own target and picked only if the CPU
+// has it, which needs the GCC/Clang target attribute
+#if defined(ROW_TOKENIZER_SSE2) && defined(__GNUC__)
+#define ROW_TOKENIZER_AVX2 1
+#include <immintrin.h>
+#endif
+
+namespace rime {
+
+namespace {
+
+// returns the number of commas found
+size_t ScanScalar(const char* data,
+                  size_t begin,
+                  size_t end,
+                  size_t maxCommas,
+                  vector<uint32_t>& positions) {
+    size_t commas = 0;
+    for (size_t i = begin; i < end && commas < maxCommas; ++i) {
+        if (data[i] == ',' || data[i] == '|') {
+            positions.push_back(i);
+            commas += data[i] == ',';
+        }
+    }
+    return commas;
+}
+
+inline unsigned CountTrailingZeros(uint32_t mask) {
+#if defined(__GNUC__)
+    return __builtin_ctz(mask);
+#else
+    unsigned count = 0;
+    while (!(mask & 1)) {
+        mask >>= 1;
+        ++count;
+    }
+    return count;
+#endif
+}
+
+inline unsigned CountBits(uint32_t mask) {
+#if defined(__GNUC__)
+    return __builtin_popcount(mask);
+#else
+    unsigned count = 0;
+    for (; mask; mask &= mask - 1)
+        ++count;
+    return count;
+#endif
+}
+
+// one bit per delimiter byte of a block, lowest bit first
+inline void AppendMask(uint32_t mask, size_t offset, vector<uint32_t>& positions) {
+    while (mask) {
+        positions.push_back(offset + CountTrailingZeros(mask));
+        mask &= mask - 1;
+    }
+}
+
+#ifdef ROW_TOKENIZER_SSE2
+void ScanSse2(const char* data, size_t size, size_t maxCommas, vector<uint32_t>& positions) {
+    const __m128i comma = _mm_set1_epi8(',');
+    const __m128i pipe = _mm_set1_epi8('|');
+    size_t i = 0, commas = 0;
+    for (; i + 16 <= size && commas < maxCommas; i += 16) {
+        const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        const uint32_t commaMask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, comma));
+        const uint32_t pipeMask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, pipe));
+        AppendMask(commaMask | pipeMask, i, positions);
+        commas += CountBits(commaMask);
+    }
+    if (commas < maxCommas)
+        ScanScalar(data, i, size, maxCommas - commas, positions);
+}
+#endif
+
+#ifdef ROW_TOKENIZER_AVX2
+__attribute__((target("avx2")))
+void ScanAvx2(const char* data, size_t size, size_t maxCommas, vector<uint32_t>& positions) {
+    const __m256i comma = _mm256_set1_epi8(',');
+    const __m256i pipe = _mm256_set1_epi8('|');
+    size_t i = 0, commas = 0;
+    for (; i + 32 <= size && commas < maxCommas; i += 32) {
+        const __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+        const uint32_t commaMask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(block, comma));
+        const uint32_t pipeMask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(block, pipe));
+        AppendMask(commaMask | pipeMask, i, positions);
+        commas += CountBits(commaMask);
+    }
+    if (commas < maxCommas)
+        ScanScalar(data, i, size, maxCommas - commas, positions);
+}
+#endif
+
+DelimiterScanner BestScanner() {
+    static const DelimiterScanner best = [] {
+        if (DelimiterScannerSupported(kAvx2Scanner))
+            return kAvx2Scanner;
+        if (DelimiterScannerSupported(kSse2Scanner))
+            return kSse2Scanner;
+        return kScalarScanner;
+    }();
+    return best;
+}
+
+}  // namespace
+
+void FindDelimiters(std::string_view text, size_t maxCommas, vector<uint32_t>& positions) {
+    FindDelimiters(text, maxCommas, positions, BestScanner());
+}
+
+void FindDelimiters(std::string_view text,
+                    size_t maxCommas,
+                    vector<uint32_t>& positions,
+                    DelimiterScanner scanner) {
+    switch (scanner) {
+#ifdef ROW_TOKENIZER_AVX2
+        case kAvx2Scanner:
+            ScanAvx2(text.data(), text.size(), maxCommas, positions);
+            return;
+#endif
+#ifdef ROW_TOKENIZER_SSE2
+        case kSse2Scanner:
+            ScanSse2(text.data(), text.size(), maxCommas, positions);
+            return;
+#endif
+        default:
+            ScanScalar(text.data(), 0, text.size(), maxCommas, positions);
+            return;
+    }
+}
+
+bool DelimiterScannerSupported(DelimiterScanner scanner) {
+    switch (scanner) {
+        case kScalarScanner:
+            return true;
+#ifdef ROW_TOKENIZER_SSE2
+        case kSse2Scanner:
+            return true;
+#endif
+#ifdef ROW_TOKENIZER_AVX2
+        case kAvx2Scanner:
+            return __builtin_cpu_supports("avx2");
+#endif
+        default:
+            return false;
+    }
+}
+
+const char* DelimiterScannerName(DelimiterScanner scanner) {
+    static const char* names[] = {"scalar", "sse2", "avx2"};
+    return scanner < kDelimiterScannerCount ? names[scanner] : "unknown";
+}
+
+}  // namespace rime
@@ -0,0 +1,37 @@
+//
+//  RowTokenizer.hpp
+//  rime-dictionary-lookup-filter-objs
+//
+
+#ifndef RowTokenizer_hpp
+#define RowTokenizer_hpp
+
+#include <rime/common.h>
+#include <cstdint>
+#include <string_view>
+
+namespace rime {
+
+// Implementations of FindDelimiters(); the fastest one the CPU supports is
+// picked at runtime.
+enum DelimiterScanner {
+    kScalarScanner,
+    kSse2Scanner,
+    kAvx2Scanner,
+    kDelimiterScannerCount
+};
+
+// Appends the position of every ',' and '|' in text, in increasing order.
+// The scan stops once maxCommas commas are found; delimiters right after the
+// last of them may be appended as well.
+void FindDelimiters(std::string_view text, size_t maxCommas, vector<uint32_t>& positions);
+void FindDelimiters(std::string_view text,
+                    size_t maxCommas,
+                    vector<uint32_t>& positions,
+                    DelimiterScanner scanner);
+
+bool DelimiterScannerSupported(DelimiterScanner scanner);
+const char* DelimiterScannerName(DelimiterScanner scanner);
+};  // namespace rime
+
+#endif /* RowTokenizer_hpp */
@@ -0,0 +1,85 @@
+//
+//  TailProjection.cpp
+//  rime-dictionary-lookup-filter-objs
+//
+
+#include "TailProjection.hpp"
+#include "RowTokenizer.hpp"
+
+#include <algorithm>
+#include <limits>
+
+namespace rime {
+
+namespace {
+
+// kept[i]: whether tail column i is kept; tail columns 0-3 are row columns
+// 3-6, the rest follow the pronOrder column 7
+vector<bool> KeptTailColumns(const vector<int>& columns) {
+    vector<bool> kept;
+    for (const int column : columns) {
+        if (column < 3 || column == 7)
+            continue;
+        const size_t tailColumn = column < 7 ? column - 3 : column - 4;
+        if (kept.size() <= tailColumn)
+            kept.resize(tailColumn + 1);
+        kept[tailColumn] = true;
+    }
+    return kept;
+}
+
+}  // namespace
+
+TailProjection::TailProjection(const LookupIndex& index,
+                               const vector<int>& matchedColumns,
+                               const vector<int>& relatedColumns)
+        : index_(index) {
+    vector<uint32_t> delimiters;
+    const vector<int>* columns[2] = {&relatedColumns, &matchedColumns};
+    for (size_t side = 0; side < 2; ++side) {
+        const vector<bool> kept = KeptTailColumns(*columns[side]);
+        fingerprint_ = HashText(side ? "\n1:" : "\n0:", fingerprint_);
+        for (size_t i = 0; i < kept.size(); ++i) {
+            if (kept[i])
+                fingerprint_ = HashText(std::to_string(i) + ",", fingerprint_);
+        }
+        if (kept.empty())
+            continue;
+        tails_[side].reserve(index.row_count());
+        for (size_t id = 0; id < index.row_count(); ++id) {
+            const std::string_view tail = index.Tail(index.row_at(id));
+            delimiters.clear();
+            FindDelimiters(tail, std::numeric_limits<size_t>::max(), delimiters);
+            const uint32_t offset = text_.size();
+            size_t column = 0, start = 0;
+            for (size_t i = 0; i <= delimiters.size() && column < kept.size(); ++i) {
+                if (i < delimiters.size() && tail[delimiters[i]] != ',')
+                    continue;
+                const size_t end = i < delimiters.size() ? delimiters[i] : tail.size();
+                if (column > 0)
+                    text_ += ',';
+                if (kept[column])
+                    text_.append(tail.data() + start, end - start);
+                ++column;
+                start = end + 1;
+            }
+            while (text_.size() > offset && text_.back() == ',')
+                text_.pop_back();
+            tails_[side].push_back({offset, uint32_t(text_.size() - offset)});
+        }
+    }
+    // no column list at all projects nothing
+    if (tails_[0].empty() && tails_[1].empty())
+        fingerprint_ = 0;
+}
+
+std::string_view TailProjection::Tail(const LookupRow& row,
+                                      const char matchInputBuffer) const {
+    const vector<TextRange>& tails = tails_[matchInputBuffer == '1'];
+    if (tails.empty())
+        return index_.Tail(row);
+    const TextRange& range = tails[index_.RowId(row)];
+    return std::string_view(text_.data() + range.offset, range.length);
+}
+
+}  // namespace rime
@@ -0,0 +1,44 @@
+//
+//  TailProjection.hpp
+//  rime-dictionary-lookup-filter-objs
+//
+
+#ifndef TailProjection_hpp
+#define TailProjection_hpp
+
+#include <rime/common.h>
+#include <cstdint>
+#include <string_view>
+#include "LookupIndex.hpp"
+
+namespace rime {
+
+// Tail columns kept in comment lines, chosen separately for rows with
+// match_input_buffer 1 and 0. Columns are numbered as in the dictionary
+// row: 3-6, and 8 and up after the pronOrder column. Columns not kept are
+// emptied in place, so kept columns stay at their position, and trailing
+// empty columns are dropped. The projected tails of all rows are built up
+// front; LookupIndexRegistry::Projection() shares them between filters.
+class TailProjection {
+  public:
+    // An empty list keeps the whole tail of those rows; columns outside the
+    // tail are ignored.
+    TailProjection(const LookupIndex& index,
+                   const vector<int>& matchedColumns,
+                   const vector<int>& relatedColumns);
+
+    std::string_view Tail(const LookupRow& row, const char matchInputBuffer) const;
+    // identifies the kept columns; 0 if every tail is kept whole
+    uint64_t fingerprint() const { return fingerprint_; }
+
+  private:
+    const LookupIndex& index_;
+    string text_;
+    // projected tail of each row by row id, per match_input_buffer; empty
+    // when that side keeps every tail whole
+    vector<TextRange> tails_[2];
+    uint64_t fingerprint_ = 0;
+};
+};  // namespace rime
+
+#endif /* TailProjection_hpp */
@@ -0,0 +1,28 @@
+//
+//  dictionary_lookup_api.h
+//  rime-dictionary-lookup-filter-objs
+//
+
+#ifndef dictionary_lookup_api_h
+#define dictionary_lookup_api_h
+
+#include <rime_api.h>
+
+// Custom API of the dictionary_lookup module, for front-ends that enable
+// compact_output:
+//
+//   RimeModule* module = rime_get_api()->find_module("dictionary_lookup");
+//   RimeDictionaryLookupApi* api = (RimeDictionaryLookupApi*)module->get_api();
+typedef struct rime_dictionary_lookup_api_t {
+    int data_size;
+
+    // Replaces the row references in a candidate comment with the full
+    // comment lines of the given lookup dictionary, loaded the way the
+    // filter loaded it. Returns NULL if no filter has loaded the dictionary,
+    // it cannot be loaded, or the comment was emitted from another version
+    // of it; the result is released with free_comment.
+    char* (*resolve_comment)(const char* dictionary, const char* comment);
+    void (*free_comment)(char* comment);
+} RimeDictionaryLookupApi;
+
+#endif /* dictionary_lookup_api_h */
@@ -9,7 +9,11 @@
 #include <rime/registry.h>
 #include <rime_api.h>
 #include "DictionaryLookupFilter.hpp"
+#include "LookupIndexRegistry.hpp"
+#include "dictionary_lookup_api.h"
 #include <rime/component.h>
+#include <cstdlib>
+#include <cstring>
 
 static void rime_dictionary_lookup_initialize() {
     using namespace rime;
@@ -22,4 +26,36 @@ static void rime_dictionary_lookup_initialize() {
 
 static void rime_dictionary_lookup_finalize() {}
 
-RIME_REGISTER_MODULE(dictionary_lookup)
+static char* rime_dictionary_lookup_resolve_comment(const char* dictionary,
+                                                    const char* comment) {
+    using namespace rime;
+
+    if (!dictionary || !comment)
+        return nullptr;
+    an<const LookupIndex> index = LookupIndexRegistry::instance().RequireAsLoaded(dictionary);
+    if (!index)
+        return nullptr;
+    string resolved;
+    if (!index->ResolveRowReferences(comment, &resolved))
+        return nullptr;
+    char* result = static_cast<char*>(std::malloc(resolved.size() + 1));
+    if (result)
+        std::memcpy(result, resolved.c_str(), resolved.size() + 1);
+    return result;
+}
+
+static void rime_dictionary_lookup_free_comment(char* comment) {
+    std::free(comment);
+}
+
+static RimeCustomApi* rime_dictionary_lookup_get_api() {
+    static RimeDictionaryLookupApi api = {};
+    if (!api.data_size) {
+        RIME_STRUCT_INIT(RimeDictionaryLookupApi, api);
+        api.resolve_comment = rime_dictionary_lookup_resolve_comment;
+        api.free_comment = rime_dictionary_lookup_free_comment;
+    }
+    return reinterpret_cast<RimeCustomApi*>(&api);
+}
+
+RIME_REGISTER_CUSTOM_MODULE(dictionary_lookup)
@@ -0,0 +1,170 @@
+//
+//  BuildCommentTable.cpp
+//  rime-dictionary-lookup-filter
+//
+//  Precompiles the comments of a lookup dictionary into a table that
+//  dictionary_lookup_filter maps at runtime instead of expanding rows.
+//
+//  usage: dictionary-lookup-build-comments [--compact] [--lookup-only]
+//             [--max-depth N] [--max-lookups N] [--max-rows N]
+//             [--max-comment-bytes N] [--matched-columns 3,4,...]
+//             [--unmatched-columns 3,4,...] [--output file]
+//             user_data_dir dictionary
+//
+//  The dictionary must have been deployed to user_data_dir, or with
+//  --lookup-only its *.dict.yaml be there. The limits, columns, --compact
+//  and --lookup-only have to match the filter options, otherwise the table
+//  is ignored. The table is written to user_data_dir/<dictionary>.comments.bin
+//  by default.
+//
+
+#include <rime_api.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "CommentTable.hpp"
+#include "LookupExpander.hpp"
+#include "LookupIndexRegistry.hpp"
+#include "TailProjection.hpp"
+
+namespace {
+
+using rime::CommentTable;
+using rime::CommentTableSettings;
+using rime::LookupExpander;
+using rime::LookupIndex;
+using std::string;
+using std::vector;
+
+int Usage(const char* program) {
+    std::fprintf(stderr,
+                 "usage: %s [--compact] [--lookup-only] [--max-depth N] [--max-lookups N]\n"
+                 "       [--max-rows N] [--max-comment-bytes N] [--matched-columns 3,4,...]\n"
+                 "       [--unmatched-columns 3,4,...] [--output file] user_data_dir dictionary\n",
+                 program);
+    return 1;
+}
+
+vector<int> ParseColumns(const char* text) {
+    vector<int> columns;
+    for (char* end; *text; text = *end ? end + 1 : end) {
+        const long column = std::strtol(text, &end, 10);
+        if (end == text)
+            break;
+        columns.push_back(column);
+    }
+    return columns;
+}
+
+// Every key a word candidate can look up: each honzi with each of its
+// pronunciations, for word and sentence lookups.
+vector<std::pair<string, string>> BuildComments(const LookupIndex& index,
+                                                LookupExpander& expander) {
+    vector<std::pair<string, string>> comments;
+    for (size_t i = 0; i < index.entry_count(); ++i) {
+        const rime::LookupEntry& entry = index.entry_at(i);
+        const string honzi(index.Text(entry.honzi));
+        for (uint32_t b = entry.firstBucket; b < entry.firstBucket + entry.bucketCount; ++b) {
+            string jyutping;
+            for (const char c : index.Text(index.bucket_at(b).pronunciation)) {
+                if (c != ';' && c != ' ')
+                    jyutping += c;
+            }
+            for (const bool isSentence : {false, true}) {
+                string key = (isSentence ? "1" : "0") + honzi + "\f" + jyutping;
+                comments.push_back({std::move(key),
+                                    expander.ParseEntry(honzi, jyutping, isSentence)});
+            }
+        }
+        if ((i + 1) % 10000 == 0)
+            std::fprintf(stderr, "%zu/%zu entries\n", i + 1, index.entry_count());
+    }
+    return comments;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    CommentTableSettings settings;
+    settings.budget.maxDepth = rime::kDefaultMaxDepth;
+    settings.budget.maxLookups = rime::kDefaultMaxLookups;
+    settings.budget.maxRows = rime::kDefaultMaxRows;
+    settings.budget.maxBytes = rime::kDefaultMaxBytes;
+    bool lookupOnly = false;
+    vector<int> matchedColumns, unmatchedColumns;
+    string output;
+    vector<const char*> arguments;
+    for (int i = 1; i < argc; ++i) {
+        const bool hasValue = i + 1 < argc;
+        if (!std::strcmp(argv[i], "--compact"))
+            settings.compact = true;
+        else if (!std::strcmp(argv[i], "--lookup-only"))
+            lookupOnly = true;
+        else if (!std::strcmp(argv[i], "--max-depth") && hasValue)
+            settings.budget.maxDepth = std::strtoul(argv[++i], nullptr, 10);
+        else if (!std::strcmp(argv[i], "--max-lookups") && hasValue)
+            settings.budget.maxLookups = std::strtoul(argv[++i], nullptr, 10);
+        else if (!std::strcmp(argv[i], "--max-rows") && hasValue)
+            settings.budget.maxRows = std::strtoul(argv[++i], nullptr, 10);
+        else if (!std::strcmp(argv[i], "--max-comment-bytes") && hasValue)
+            settings.budget.maxBytes = std::strtoul(argv[++i], nullptr, 10);
+        else if (!std::strcmp(argv[i], "--matched-columns") && hasValue)
+            matchedColumns = ParseColumns(argv[++i]);
+        else if (!std::strcmp(argv[i], "--unmatched-columns") && hasValue)
+            unmatchedColumns = ParseColumns(argv[++i]);
+        else if (!std::strcmp(argv[i], "--output") && hasValue)
+            output = argv[++i];
+        else if (argv[i][0] == '-')
+            return Usage(argv[0]);
+        else
+            arguments.push_back(argv[i]);
+    }
+    if (arguments.size() != 2)
+        return Usage(argv[0]);
+    const string userDataDir = arguments[0];
+    const string dictname = arguments[1];
+    if (output.empty())
+        output = userDataDir + "/" + dictname + ".comments.bin";
+
+    RIME_STRUCT(RimeTraits, traits);
+    traits.shared_data_dir = userDataDir.c_str();
+    traits.user_data_dir = userDataDir.c_str();
+    traits.app_name = "rime.dictionary_lookup_build_comments";
+    RimeApi* rime = rime_get_api();
+    rime->setup(&traits);
+    rime->initialize(&traits);
+
+    const auto start = std::chrono::steady_clock::now();
+    int status = 0;
+    if (rime::an<LookupIndex> index = rime::LoadLookupIndex(dictname, lookupOnly)) {
+        // as the filter does: no projection for compact output
+        rime::the<rime::TailProjection> projection;
+        if (!settings.compact && (!matchedColumns.empty() || !unmatchedColumns.empty()))
+            projection.reset(new rime::TailProjection(*index, matchedColumns, unmatchedColumns));
+        settings.projection = projection ? projection->fingerprint() : 0;
+        LookupExpander expander(2000);
+        expander.Reset(index.get(), projection.get());
+        expander.set_budget(settings.budget);
+        expander.set_compact(settings.compact);
+        settings.fingerprint = index->fingerprint();
+        const auto comments = BuildComments(*index, expander);
+        if (CommentTable::Write(output, settings, comments)) {
+            const auto elapsed = std::chrono::duration_cast<std::chrono::seconds>(
+                    std::chrono::steady_clock::now() - start);
+            std::printf("wrote %zu comments to %s in %lld s\n", comments.size(),
+                        output.c_str(), (long long)elapsed.count());
+        } else {
+            std::fprintf(stderr, "cannot write %s\n", output.c_str());
+            status = 1;
+        }
+    } else {
+        std::fprintf(stderr, "cannot load dictionary '%s' from %s\n", dictname.c_str(),
+                     userDataDir.c_str());
+        status = 1;
+    }
+    rime->finalize();
+    return status;
+}
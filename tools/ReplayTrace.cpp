@@ -0,0 +1,395 @@
+//
+//  ReplayTrace.cpp
+//  rime-dictionary-lookup-filter
+//
+//  Replays recorded keystrokes through a schema with dictionary_lookup_filter
+//  and reports the latency the filter adds to each keystroke, along with the
+//  size of the comments on the visible menu page.
+//
+//  usage: dictionary-lookup-replay [--iterations N] [--schema id]
+//             [--golden file | --check file] [--max-rows N] data_dir trace
+//
+//  data_dir holds the schema and its dictionaries, e.g. a copy of
+//  tools/replay; the schema is deployed there first. Each line of the trace
+//  is one composition in librime key sequence notation, such as
+//  "neihou{Page_Down}{space}"; the composition is cleared after each line,
+//  and lines starting with '#' are skipped.
+//
+//  The schema has to wrap the filter in replay_timer@before and
+//  replay_timer@after: the filter's time is what the translation after it
+//  takes minus what the one before it takes.
+//
+//  --golden writes a hash of every candidate text and comment on the
+//  visible page, per trace line; --check compares against such a file, so
+//  optimizations can be checked for byte-identical output. --max-rows fails
+//  when a comment on the visible page has more rows, which checks the
+//  filter's max_rows against a trace of words.
+//
+
+#include <rime_api.h>
+#include <rime/candidate.h>
+#include <rime/common.h>
+#include <rime/component.h>
+#include <rime/filter.h>
+#include <rime/key_event.h>
+#include <rime/registry.h>
+#include <rime/ticket.h>
+#include <rime/translation.h>
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+using std::string;
+using std::vector;
+typedef std::chrono::steady_clock Clock;
+
+// Time spent in the translations of replay_timer@before and @after since the
+// last keystroke, and the filter's own Apply() between them.
+struct ReplayTimes {
+    Clock::duration before{};
+    Clock::duration after{};
+    Clock::duration apply{};
+    Clock::time_point beforeApplied;
+
+    Clock::duration filter() const { return after - before + apply; }
+};
+
+ReplayTimes times;
+
+class TimedTranslation : public rime::Translation {
+  public:
+    TimedTranslation(rime::an<rime::Translation> translation, Clock::duration* elapsed)
+            : translation_(translation), elapsed_(elapsed) {
+        set_exhausted(!translation_ || translation_->exhausted());
+    }
+
+    virtual bool Next() {
+        const auto start = Clock::now();
+        const bool next = translation_->Next();
+        set_exhausted(translation_->exhausted());
+        *elapsed_ += Clock::now() - start;
+        return next;
+    }
+
+    virtual rime::an<rime::Candidate> Peek() {
+        const auto start = Clock::now();
+        rime::an<rime::Candidate> candidate = translation_->Peek();
+        *elapsed_ += Clock::now() - start;
+        return candidate;
+    }
+
+  private:
+    rime::an<rime::Translation> translation_;
+    Clock::duration* elapsed_;
+};
+
+// Put right before and right after the filter to be timed; translations
+// through the filter include the time of everything before it.
+class ReplayTimer : public rime::Filter {
+  public:
+    explicit ReplayTimer(const rime::Ticket& ticket) : Filter(ticket) {}
+
+    virtual rime::an<rime::Translation> Apply(rime::an<rime::Translation> translation,
+                                              rime::CandidateList* candidates) {
+        const bool before = name_space_ == "before";
+        if (!before && times.beforeApplied != Clock::time_point()) {
+            times.apply += Clock::now() - times.beforeApplied;
+            times.beforeApplied = Clock::time_point();
+        }
+        auto timed = rime::New<TimedTranslation>(translation,
+                                                 before ? &times.before : &times.after);
+        if (before)
+            times.beforeApplied = Clock::now();
+        return timed;
+    }
+};
+
+}  // namespace
+
+static void rime_replay_initialize() {
+    rime::Registry::instance().Register("replay_timer",
+                                        new rime::Component<ReplayTimer>);
+}
+
+static void rime_replay_finalize() {}
+
+RIME_REGISTER_MODULE(replay)
+
+namespace {
+
+int Usage(const char* program) {
+    std::fprintf(stderr,
+                 "usage: %s [--iterations N] [--schema id] [--golden file | --check file]\n"
+                 "       [--max-rows N] data_dir trace\n",
+                 program);
+    return 1;
+}
+
+// 64-bit FNV-1a over the text and a terminator.
+uint64_t Hash(const char* text, uint64_t hash) {
+    for (; text && *text; ++text) {
+        hash ^= uint8_t(*text);
+        hash *= 1099511628211ull;
+    }
+    // keeps "ab" + "c" apart from "a" + "bc"
+    hash ^= 0xff;
+    return hash * 1099511628211ull;
+}
+
+// rows of a comment, i.e. lines flagged with match_input_buffer
+size_t CommentRows(const char* comment) {
+    size_t rows = 0;
+    for (const char* p = comment; p && *p; ++p) {
+        if (p[0] == '\r' && (p[1] == '0' || p[1] == '1'))
+            ++rows;
+    }
+    return rows;
+}
+
+double Micros(Clock::duration duration) {
+    return std::chrono::duration<double, std::micro>(duration).count();
+}
+
+void Report(const char* name, vector<double> values) {
+    if (values.empty())
+        return;
+    std::sort(values.begin(), values.end());
+    auto percentile = [&](double p) {
+        return values[std::min(values.size() - 1, size_t(p * values.size()))];
+    };
+    std::printf("%-16s %10.1f %10.1f %10.1f\n", name, percentile(0.5), percentile(0.99),
+                values.back());
+}
+
+struct Replay {
+    vector<double> keystrokeMicros;
+    vector<double> filterMicros;
+    vector<double> commentBytes;
+    vector<double> commentRows;
+    // per trace line
+    vector<uint64_t> hashes;
+    vector<size_t> maxRows;
+};
+
+bool ReplayTrace(RimeApi* rime, RimeSessionId session, const vector<string>& trace,
+                 bool timed, Replay& replay) {
+    for (const string& line : trace) {
+        rime::KeySequence keys;
+        if (!keys.Parse(line)) {
+            std::fprintf(stderr, "cannot parse key sequence: %s\n", line.c_str());
+            return false;
+        }
+        uint64_t hash = 14695981039346656037ull;
+        size_t lineRows = 0;
+        for (const rime::KeyEvent& key : keys) {
+            times = ReplayTimes();
+            const auto start = Clock::now();
+            rime->process_key(session, key.keycode(), key.modifier());
+            RIME_STRUCT(RimeContext, context);
+            // building the visible page pulls its candidates through the filters
+            const bool hasContext = rime->get_context(session, &context);
+            const auto elapsed = Clock::now() - start;
+            size_t bytes = 0, rows = 0;
+            if (hasContext) {
+                for (int i = 0; i < context.menu.num_candidates; ++i) {
+                    const RimeCandidate& candidate = context.menu.candidates[i];
+                    hash = Hash(candidate.text, hash);
+                    hash = Hash(candidate.comment, hash);
+                    bytes += candidate.comment ? std::strlen(candidate.comment) : 0;
+                    rows = std::max(rows, CommentRows(candidate.comment));
+                }
+                rime->free_context(&context);
+            }
+            lineRows = std::max(lineRows, rows);
+            RIME_STRUCT(RimeCommit, commit);
+            if (rime->get_commit(session, &commit))
+                rime->free_commit(&commit);
+            if (timed) {
+                replay.keystrokeMicros.push_back(Micros(elapsed));
+                replay.filterMicros.push_back(Micros(times.filter()));
+                replay.commentBytes.push_back(bytes);
+                replay.commentRows.push_back(rows);
+            }
+        }
+        rime->clear_composition(session);
+        replay.hashes.push_back(hash);
+        replay.maxRows.push_back(lineRows);
+    }
+    return true;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    int iterations = 3;
+    string schema = "replay";
+    string golden, check;
+    size_t maxRows = 0;
+    vector<const char*> arguments;
+    for (int i = 1; i < argc; ++i) {
+        const bool hasValue = i + 1 < argc;
+        if (!std::strcmp(argv[i], "--iterations") && hasValue)
+            iterations = std::max(1, std::atoi(argv[++i]));
+        else if (!std::strcmp(argv[i], "--schema") && hasValue)
+            schema = argv[++i];
+        else if (!std::strcmp(argv[i], "--golden") && hasValue)
+            golden = argv[++i];
+        else if (!std::strcmp(argv[i], "--check") && hasValue)
+            check = argv[++i];
+        else if (!std::strcmp(argv[i], "--max-rows") && hasValue)
+            maxRows = std::max(0, std::atoi(argv[++i]));
+        else if (argv[i][0] == '-')
+            return Usage(argv[0]);
+        else
+            arguments.push_back(argv[i]);
+    }
+    if (arguments.size() != 2 || (!golden.empty() && !check.empty()))
+        return Usage(argv[0]);
+    const string dataDir = arguments[0];
+
+    vector<string> trace;
+    {
+        std::ifstream in(arguments[1]);
+        if (!in) {
+            std::fprintf(stderr, "cannot read %s\n", arguments[1]);
+            return 1;
+        }
+        string line;
+        while (std::getline(in, line)) {
+            if (!line.empty() && line.back() == '\r')
+                line.pop_back();
+            if (!line.empty() && line[0] != '#')
+                trace.push_back(line);
+        }
+    }
+
+    RIME_STRUCT(RimeTraits, traits);
+    traits.shared_data_dir = dataDir.c_str();
+    traits.user_data_dir = dataDir.c_str();
+    traits.app_name = "rime.dictionary_lookup_replay";
+    const char* modules[] = {"default", "dictionary_lookup", "replay", nullptr};
+    traits.modules = modules;
+    RimeApi* rime = rime_get_api();
+    rime->setup(&traits);
+    rime->initialize(&traits);
+    const string schemaFile = dataDir + "/" + schema + ".schema.yaml";
+    if (!rime->deploy_schema(schemaFile.c_str())) {
+        std::fprintf(stderr, "cannot deploy %s\n", schemaFile.c_str());
+        rime->finalize();
+        return 1;
+    }
+    const RimeSessionId session = rime->create_session();
+    if (!session || !rime->select_schema(session, schema.c_str())) {
+        std::fprintf(stderr, "cannot select schema '%s'\n", schema.c_str());
+        rime->finalize();
+        return 1;
+    }
+
+    // the first pass loads the dictionaries and is only timed when it is the
+    // only one
+    Replay replay;
+    int status = 0;
+    for (int iteration = 0; iteration < iterations && status == 0; ++iteration) {
+        Replay pass;
+        if (!ReplayTrace(rime, session, trace, iterations == 1 || iteration > 0, pass)) {
+            status = 1;
+            break;
+        }
+        if (iteration == 0) {
+            replay.hashes = pass.hashes;
+            replay.maxRows = pass.maxRows;
+        }
+        else if (pass.hashes != replay.hashes)
+            std::fprintf(stderr, "warning: pass %d emitted other comments than pass 1\n",
+                         iteration + 1);
+        replay.keystrokeMicros.insert(replay.keystrokeMicros.end(),
+                                      pass.keystrokeMicros.begin(), pass.keystrokeMicros.end());
+        replay.filterMicros.insert(replay.filterMicros.end(), pass.filterMicros.begin(),
+                                   pass.filterMicros.end());
+        replay.commentBytes.insert(replay.commentBytes.end(), pass.commentBytes.begin(),
+                                   pass.commentBytes.end());
+        replay.commentRows.insert(replay.commentRows.end(), pass.commentRows.begin(),
+                                  pass.commentRows.end());
+    }
+    rime->destroy_session(session);
+    rime->finalize();
+    if (status != 0)
+        return status;
+
+    std::printf("%zu trace lines, %zu timed keystrokes\n", trace.size(),
+                replay.keystrokeMicros.size());
+    std::printf("%-16s %10s %10s %10s\n", "per keystroke", "p50", "p99", "max");
+    Report("keystroke (us)", replay.keystrokeMicros);
+    Report("filter (us)", replay.filterMicros);
+    Report("comment bytes", replay.commentBytes);
+    Report("comment rows", replay.commentRows);
+
+    if (maxRows > 0) {
+        size_t over = 0;
+        for (size_t i = 0; i < replay.maxRows.size(); ++i) {
+            if (replay.maxRows[i] > maxRows) {
+                std::fprintf(stderr, "trace line %zu has a comment of %zu rows: %s\n", i + 1,
+                             replay.maxRows[i], trace[i].c_str());
+                ++over;
+            }
+        }
+        if (over) {
+            std::fprintf(stderr, "%zu of %zu trace lines exceed %zu rows\n", over,
+                         replay.maxRows.size(), maxRows);
+            return 1;
+        }
+        std::printf("no comment exceeds %zu rows\n", maxRows);
+    }
+
+    if (!golden.empty()) {
+        std::ofstream out(golden, std::ios::trunc);
+        for (size_t i = 0; i < replay.hashes.size(); ++i) {
+            char line[64];
+            std::snprintf(line, sizeof(line), "%zu %016" PRIx64 "\n", i + 1, replay.hashes[i]);
+            out << line;
+        }
+        if (!out) {
+            std::fprintf(stderr, "cannot write %s\n", golden.c_str());
+            return 1;
+        }
+        std::printf("wrote %zu hashes to %s\n", replay.hashes.size(), golden.c_str());
+    }
+    if (!check.empty()) {
+        std::ifstream in(check);
+        vector<uint64_t> expected;
+        size_t number;
+        char hash[32];
+        string line;
+        while (std::getline(in, line)) {
+            if (std::sscanf(line.c_str(), "%zu %31s", &number, hash) == 2)
+                expected.push_back(std::strtoull(hash, nullptr, 16));
+        }
+        if (expected.size() != replay.hashes.size()) {
+            std::fprintf(stderr, "%s has %zu hashes, the trace has %zu lines\n",
+                         check.c_str(), expected.size(), replay.hashes.size());
+            return 1;
+        }
+        size_t mismatches = 0;
+        for (size_t i = 0; i < expected.size(); ++i) {
+            if (expected[i] != replay.hashes[i]) {
+                std::fprintf(stderr, "trace line %zu differs: %s\n", i + 1, trace[i].c_str());
+                ++mismatches;
+            }
+        }
+        if (mismatches) {
+            std::fprintf(stderr, "%zu of %zu trace lines differ\n", mismatches,
+                         expected.size());
+            return 1;
+        }
+        std::printf("all %zu trace lines match %s\n", expected.size(), check.c_str());
+    }
+    return 0;
+}